@@ -0,0 +1,266 @@
+// Counts the Vulkan commands gfx_cmd_dispatch records per dispatch, for back-to-back dispatches of one pipeline and for alternating pipelines.
+// The vkCmd* entry points the library calls are defined here, count the call and forward to the driver. This relies on the executable's
+// definitions taking precedence over the loader's, which holds when gfx2 is linked statically (the default) on ELF platforms.
+#include "gfx2.h"
+#include "gfx2_vulkan.h"
+#include "detail/common.hpp"
+
+#include "shaderc/shaderc.hpp"
+#include "vulkan/vulkan_core.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <print>
+#include <vector>
+
+namespace
+{
+  constexpr uint32_t NUM_DISPATCHES = 10'000;
+
+  constexpr char sShader[] = R"(
+#version 460 core
+layout(local_size_x_id = 0) in;
+void main()
+{
+}
+  )";
+
+  struct CallCounts
+  {
+    uint64_t bindPipeline;
+    uint64_t bindDescriptorSets;
+    uint64_t pushConstants;
+    uint64_t dispatch;
+    uint64_t pipelineBarrier;
+  };
+
+  CallCounts sCounts;
+
+  // The driver's entry points, fetched with vkGetDeviceProcAddr so they bypass the definitions below.
+  PFN_vkCmdBindPipeline sBindPipeline;
+  PFN_vkCmdBindDescriptorSets sBindDescriptorSets;
+  PFN_vkCmdPushConstants sPushConstants;
+  PFN_vkCmdDispatch sDispatch;
+  PFN_vkCmdPipelineBarrier2 sPipelineBarrier2;
+
+  template<typename PFN>
+  void LoadDeviceFunction(VkDevice device, const char* name, PFN& function)
+  {
+    function = reinterpret_cast<PFN>(vkGetDeviceProcAddr(device, name));
+    if (!function)
+    {
+      throw std::runtime_error(name);
+    }
+  }
+
+  std::vector<uint32_t> CompileShader()
+  {
+    auto compiler = shaderc::Compiler();
+    auto options  = shaderc::CompileOptions();
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
+
+    auto result = compiler.CompileGlslToSpv(sShader, sizeof(sShader) - 1, shaderc_compute_shader, "dispatch_calls.comp", options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+    {
+      throw std::runtime_error(result.GetErrorMessage());
+    }
+    return {result.begin(), result.end()};
+  }
+
+  struct VulkanObjects
+  {
+    VkInstance instance;
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t queueFamilyIndices[GFX_NUM_QUEUES];
+  };
+
+  // Like the example's setup, except that devices with a single queue family use it for every queue.
+  bool InitializeVulkan(VulkanObjects& objects)
+  {
+    auto appInfo = VkApplicationInfo{
+      .sType      = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .apiVersion = VK_API_VERSION_1_3,
+    };
+    if (vkCreateInstance(ToPtr(VkInstanceCreateInfo{.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO, .pApplicationInfo = &appInfo}),
+          nullptr,
+          &objects.instance) != VK_SUCCESS)
+    {
+      return false;
+    }
+
+    auto u32one = uint32_t{1};
+    if (vkEnumeratePhysicalDevices(objects.instance, &u32one, &objects.physicalDevice) < 0 || !objects.physicalDevice)
+    {
+      return false;
+    }
+
+    auto& indices = objects.queueFamilyIndices;
+    if (gfx_vulkan_get_queue_family_indices(objects.physicalDevice, &indices[0], &indices[1], &indices[2]))
+    {
+      std::ranges::fill(indices, 0u);
+    }
+
+    auto f32one           = float{1};
+    auto queueCreateInfos = std::vector<VkDeviceQueueCreateInfo>();
+    for (auto index : indices)
+    {
+      if (std::ranges::none_of(queueCreateInfos, [index](const auto& info) { return info.queueFamilyIndex == index; }))
+      {
+        queueCreateInfos.push_back(VkDeviceQueueCreateInfo{
+          .sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+          .queueFamilyIndex = index,
+          .queueCount       = 1,
+          .pQueuePriorities = &f32one,
+        });
+      }
+    }
+
+    auto features13 = VkPhysicalDeviceVulkan13Features{};
+    auto features12 = VkPhysicalDeviceVulkan12Features{};
+    auto features11 = VkPhysicalDeviceVulkan11Features{};
+    auto features10 = VkPhysicalDeviceFeatures2{};
+    gfx_vulkan_get_required_features(&features10, &features11, &features12, &features13);
+
+    return vkCreateDevice(objects.physicalDevice,
+             ToPtr(VkDeviceCreateInfo{
+               .sType                = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+               .pNext                = &features10,
+               .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
+               .pQueueCreateInfos    = queueCreateInfos.data(),
+             }),
+             nullptr,
+             &objects.device) == VK_SUCCESS;
+  }
+
+  // Records NUM_DISPATCHES dispatches into one command buffer, choosing the pipeline for each with pick, and prints the calls per dispatch.
+  template<typename F>
+  void Measure(const char* name, F&& pick)
+  {
+    auto cmd = gfx_create_command_buffer(GFX_QUEUE_COMPUTE);
+
+    sCounts          = {};
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < NUM_DISPATCHES; i++)
+    {
+      gfx_cmd_dispatch(cmd, pick(i), 1, 1, 1, nullptr);
+    }
+    const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+
+    gfx_wait_submit(gfx_submit(cmd, nullptr, 0));
+    gfx_destroy_command_buffer(cmd);
+
+    const auto PerDispatch = [](uint64_t count) { return static_cast<double>(count) / NUM_DISPATCHES; };
+    std::println("{:>12} {:>14.3f} {:>14.3f} {:>14.3f} {:>14.3f} {:>14.3f} {:>14.1f}",
+      name,
+      PerDispatch(sCounts.bindPipeline),
+      PerDispatch(sCounts.bindDescriptorSets),
+      PerDispatch(sCounts.pushConstants),
+      PerDispatch(sCounts.dispatch),
+      PerDispatch(sCounts.pipelineBarrier),
+      elapsed.count() / NUM_DISPATCHES);
+  }
+} // namespace
+
+extern "C"
+{
+  VKAPI_ATTR void VKAPI_CALL vkCmdBindPipeline(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipeline pipeline)
+  {
+    sCounts.bindPipeline++;
+    sBindPipeline(commandBuffer, bindPoint, pipeline);
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkCmdBindDescriptorSets(VkCommandBuffer commandBuffer,
+    VkPipelineBindPoint bindPoint,
+    VkPipelineLayout layout,
+    uint32_t firstSet,
+    uint32_t descriptorSetCount,
+    const VkDescriptorSet* pDescriptorSets,
+    uint32_t dynamicOffsetCount,
+    const uint32_t* pDynamicOffsets)
+  {
+    sCounts.bindDescriptorSets++;
+    sBindDescriptorSets(commandBuffer, bindPoint, layout, firstSet, descriptorSetCount, pDescriptorSets, dynamicOffsetCount, pDynamicOffsets);
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkCmdPushConstants(VkCommandBuffer commandBuffer,
+    VkPipelineLayout layout,
+    VkShaderStageFlags stageFlags,
+    uint32_t offset,
+    uint32_t size,
+    const void* pValues)
+  {
+    sCounts.pushConstants++;
+    sPushConstants(commandBuffer, layout, stageFlags, offset, size, pValues);
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkCmdDispatch(VkCommandBuffer commandBuffer, uint32_t x, uint32_t y, uint32_t z)
+  {
+    sCounts.dispatch++;
+    sDispatch(commandBuffer, x, y, z);
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkCmdPipelineBarrier2(VkCommandBuffer commandBuffer, const VkDependencyInfo* pDependencyInfo)
+  {
+    sCounts.pipelineBarrier++;
+    sPipelineBarrier2(commandBuffer, pDependencyInfo);
+  }
+}
+
+int main()
+{
+  auto objects = VulkanObjects{};
+  if (!InitializeVulkan(objects))
+  {
+    std::println("No Vulkan 1.3 device available.");
+    return 1;
+  }
+
+  LoadDeviceFunction(objects.device, "vkCmdBindPipeline", sBindPipeline);
+  LoadDeviceFunction(objects.device, "vkCmdBindDescriptorSets", sBindDescriptorSets);
+  LoadDeviceFunction(objects.device, "vkCmdPushConstants", sPushConstants);
+  LoadDeviceFunction(objects.device, "vkCmdDispatch", sDispatch);
+  LoadDeviceFunction(objects.device, "vkCmdPipelineBarrier2", sPipelineBarrier2);
+
+  auto initInfo = gfx_vulkan_init_info{
+    .instance                 = objects.instance,
+    .physicalDevice           = objects.physicalDevice,
+    .device                   = objects.device,
+    .graphicsQueueFamilyIndex = objects.queueFamilyIndices[0],
+    .computeQueueFamilyIndex  = objects.queueFamilyIndices[1],
+    .transferQueueFamilyIndex = objects.queueFamilyIndices[2],
+    .deferDestruction         = 0,
+  };
+  gfx_vulkan_initialize(&initInfo);
+
+  // The same shader with different workgroup sizes, so the two pipelines are not deduplicated into one.
+  const auto code      = CompileShader();
+  const auto codeSpan  = gfx_byte_span{.ptr = code.data(), .size = code.size() * sizeof(uint32_t)};
+  const auto constants = std::array{gfx_specialization_constant{.id = 0, .value = 32}, gfx_specialization_constant{.id = 0, .value = 64}};
+  auto pipelines       = std::array<gfx_compute_pipeline, 2>();
+  for (size_t i = 0; i < pipelines.size(); i++)
+  {
+    pipelines[i] = gfx_create_compute_pipeline_ex(ToPtr(gfx_compute_pipeline_create_info{
+      .code                         = codeSpan,
+      .specialization_constants     = &constants[i],
+      .num_specialization_constants = 1,
+    }));
+  }
+
+  std::println("{:>12} {:>14} {:>14} {:>14} {:>14} {:>14} {:>14}", "", "bind pipeline", "bind set", "push", "dispatch", "barrier", "record (ns)");
+  Measure("same", [&](uint32_t) { return pipelines[0]; });
+  Measure("alternating", [&](uint32_t i) { return pipelines[i % 2]; });
+
+  for (auto pipeline : pipelines)
+  {
+    gfx_destroy_compute_pipeline(pipeline);
+  }
+  gfx_vulkan_shutdown();
+
+  vkDestroyDevice(objects.device, nullptr);
+  vkDestroyInstance(objects.instance, nullptr);
+
+  return 0;
+}
\ No newline at end of file
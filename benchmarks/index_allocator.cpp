@@ -0,0 +1,159 @@
+// Measures IndexAllocator construction and allocate/free throughput, next to the std::stack based allocator it replaced as a reference.
+#include "detail/context.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
+#include <print>
+#include <random>
+#include <ranges>
+#include <stack>
+#include <vector>
+
+namespace
+{
+  using gfx2::internal::IndexAllocator;
+
+  // Same sizes as the descriptor allocators in Context.
+  constexpr uint32_t NUM_IMAGE_DESCRIPTORS   = 1'000'000;
+  constexpr uint32_t NUM_SAMPLER_DESCRIPTORS = 1000;
+  constexpr uint32_t NUM_STARTUP_RUNS        = 20;
+  constexpr uint32_t NUM_CHURN_OPERATIONS    = 10'000'000;
+
+  class StackIndexAllocator
+  {
+  public:
+    StackIndexAllocator(uint32_t numIndices)
+    {
+      for (auto i : std::ranges::reverse_view(std::views::iota(uint32_t(0), numIndices)))
+      {
+        freeSlots_.push(i);
+      }
+    }
+
+    uint32_t Allocate()
+    {
+      const auto index = freeSlots_.top();
+      freeSlots_.pop();
+      return index;
+    }
+
+    void Free(uint32_t index)
+    {
+      freeSlots_.push(index);
+    }
+
+  private:
+    std::stack<uint32_t> freeSlots_;
+  };
+
+  template<typename F>
+  double Nanoseconds(F&& f)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+  }
+
+  // Constructs the three descriptor allocators Context creates at startup.
+  template<typename Allocator>
+  double StartupMicroseconds()
+  {
+    auto total = 0.0;
+    for (uint32_t run = 0; run < NUM_STARTUP_RUNS; run++)
+    {
+      total += Nanoseconds(
+        [&]
+        {
+          auto storage  = Allocator(NUM_IMAGE_DESCRIPTORS);
+          auto sampled  = Allocator(NUM_IMAGE_DESCRIPTORS);
+          auto samplers = Allocator(NUM_SAMPLER_DESCRIPTORS);
+        });
+    }
+    return total / NUM_STARTUP_RUNS / 1000.0;
+  }
+
+  struct Throughput
+  {
+    double allocateNs;
+    double freeNs;
+    double churnNs;
+  };
+
+  // Allocates numLive indices, frees and reallocates random ones, then frees everything in random order.
+  template<typename Allocator>
+  Throughput MeasureThroughput(uint32_t numLive, uint64_t& checksum)
+  {
+    auto rng       = std::mt19937(1234);
+    auto allocator = Allocator(NUM_IMAGE_DESCRIPTORS);
+    auto live      = std::vector<uint32_t>(numLive);
+
+    const auto allocateNs = Nanoseconds(
+      [&]
+      {
+        for (auto& index : live)
+        {
+          index = allocator.Allocate();
+        }
+      });
+
+    auto slots = std::vector<uint32_t>(NUM_CHURN_OPERATIONS);
+    std::ranges::generate(slots, [&] { return rng() % numLive; });
+
+    const auto churnNs = Nanoseconds(
+      [&]
+      {
+        for (auto slot : slots)
+        {
+          allocator.Free(live[slot]);
+          live[slot] = allocator.Allocate();
+        }
+      });
+
+    checksum += std::accumulate(live.begin(), live.end(), uint64_t{0});
+    std::ranges::shuffle(live, rng);
+
+    const auto freeNs = Nanoseconds(
+      [&]
+      {
+        for (auto index : live)
+        {
+          allocator.Free(index);
+        }
+      });
+
+    return {
+      .allocateNs = allocateNs / numLive,
+      .freeNs     = freeNs / numLive,
+      .churnNs    = churnNs / NUM_CHURN_OPERATIONS,
+    };
+  }
+
+  template<typename Allocator>
+  void PrintThroughput(const char* name, uint32_t numLive, uint64_t& checksum)
+  {
+    const auto result = MeasureThroughput<Allocator>(numLive, checksum);
+    std::println("{:>8} {:>10} {:>16.1f} {:>16.1f} {:>24.1f}", name, numLive, result.allocateNs, result.freeNs, result.churnNs);
+  }
+} // namespace
+
+int main()
+{
+  std::println("startup (two image allocators and a sampler allocator):");
+  std::println("  bitset: {:.1f} us", StartupMicroseconds<IndexAllocator>());
+  std::println("  stack:  {:.1f} us", StartupMicroseconds<StackIndexAllocator>());
+  std::println("");
+
+  auto checksum = uint64_t{0};
+  std::println("{:>8} {:>10} {:>16} {:>16} {:>24}", "", "live", "allocate (ns)", "free (ns)", "free+allocate pair (ns)");
+  for (uint32_t numLive : {1'000u, 100'000u, 1'000'000u})
+  {
+    PrintThroughput<IndexAllocator>("bitset", numLive, checksum);
+    PrintThroughput<StackIndexAllocator>("stack", numLive, checksum);
+  }
+  std::println("(checksum {:x})", checksum);
+
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+// Measures MemoryMappings lookups as the number of live allocations grows. Lookups are O(log n), so unlike the linear scan reference their cost
+// should grow only slowly (mostly from cache misses once the maps outgrow the cache).
+#include "detail/context.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <print>
+#include <random>
+#include <vector>
+
+namespace
+{
+  using gfx2::internal::MemoryMapping;
+  using gfx2::internal::MemoryMappings;
+
+  constexpr uint32_t NUM_LOOKUPS = 1'000'000;
+
+  // The linear scan MemoryMappings used before, as a reference. It is only run for small counts, and with fewer lookups, to keep the run short.
+  constexpr uint32_t MAX_LINEAR_SCAN_ALLOCATIONS = 10'000;
+  constexpr uint32_t NUM_LINEAR_SCAN_LOOKUPS     = 10'000;
+
+  // Fake address ranges shaped like gfx_malloc's: varying sizes with gaps between them, and device addresses unrelated to host addresses.
+  std::vector<MemoryMapping> MakeMappings(uint32_t count, std::mt19937_64& rng)
+  {
+    auto sizes    = std::uniform_int_distribution<uint64_t>(16, 64 * 1024);
+    auto mappings = std::vector<MemoryMapping>();
+    mappings.reserve(count);
+
+    auto host   = uintptr_t{0x1000'0000};
+    auto device = VkDeviceAddress{0x7'0000'0000};
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const auto size = sizes(rng);
+      mappings.push_back(MemoryMapping{
+        .begin             = host,
+        .end               = host + size,
+        .deviceAddress     = device,
+        .size              = size,
+        .allocation        = nullptr,
+        .buffer            = nullptr,
+        .bufferOffset      = 0,
+        .virtualBlock      = nullptr,
+        .virtualAllocation = nullptr,
+      });
+      host   += size + 256;
+      device += size + 4096;
+    }
+
+    return mappings;
+  }
+
+  VkDeviceAddress LinearHostToDeviceAddress(const std::vector<MemoryMapping>& mappings, const void* ptr)
+  {
+    const auto uPtr = reinterpret_cast<uintptr_t>(ptr);
+    for (const auto& mapping : mappings)
+    {
+      if (uPtr >= mapping.begin && uPtr < mapping.end)
+      {
+        return mapping.deviceAddress + (uPtr - mapping.begin);
+      }
+    }
+    return 0;
+  }
+
+  template<typename F>
+  double NanosecondsPerLookup(uint32_t numLookups, F&& lookup)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numLookups; i++)
+    {
+      lookup(i);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / numLookups;
+  }
+} // namespace
+
+int main()
+{
+  auto rng = std::mt19937_64(1234);
+
+  std::println("{:>12} {:>20} {:>20} {:>20}", "allocations", "host->device (ns)", "device->mapping (ns)", "linear scan (ns)");
+  for (uint32_t count : {100u, 1'000u, 10'000u, 100'000u, 1'000'000u})
+  {
+    const auto mappings = MakeMappings(count, rng);
+
+    auto memoryMappings = MemoryMappings();
+    for (const auto& mapping : mappings)
+    {
+      memoryMappings.Insert(mapping);
+    }
+
+    // Precompute random interior addresses so the timed loops only measure the lookups.
+    auto pick       = std::uniform_int_distribution<uint32_t>(0, count - 1);
+    auto hostPtrs   = std::vector<const void*>(NUM_LOOKUPS);
+    auto devicePtrs = std::vector<const void*>(NUM_LOOKUPS);
+    for (uint32_t i = 0; i < NUM_LOOKUPS; i++)
+    {
+      const auto& mapping = mappings[pick(rng)];
+      const auto offset   = rng() % mapping.size;
+      hostPtrs[i]         = reinterpret_cast<const void*>(mapping.begin + offset);
+      devicePtrs[i]       = reinterpret_cast<const void*>(mapping.deviceAddress + offset);
+    }
+
+    auto checksum       = uint64_t{0};
+    const auto hostNs   = NanosecondsPerLookup(NUM_LOOKUPS, [&](uint32_t i) { checksum += memoryMappings.HostToDeviceAddress(hostPtrs[i]); });
+    const auto deviceNs = NanosecondsPerLookup(NUM_LOOKUPS, [&](uint32_t i) { checksum += memoryMappings.DeviceAddressToMapping(devicePtrs[i]).begin; });
+
+    if (count <= MAX_LINEAR_SCAN_ALLOCATIONS)
+    {
+      const auto linearNs = NanosecondsPerLookup(NUM_LINEAR_SCAN_LOOKUPS, [&](uint32_t i) { checksum += LinearHostToDeviceAddress(mappings, hostPtrs[i]); });
+      std::println("{:>12} {:>20.1f} {:>20.1f} {:>20.1f} (checksum {:x})", count, hostNs, deviceNs, linearNs, checksum);
+    }
+    else
+    {
+      std::println("{:>12} {:>20.1f} {:>20.1f} {:>20} (checksum {:x})", count, hostNs, deviceNs, "-", checksum);
+    }
+  }
+
+  return 0;
+}
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "vulkan/vulkan_core.h"
 
 #include <cassert>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <memory>
@@ -26,22 +27,17 @@ layout(buffer_reference, buffer_reference_align = 4) buffer Data
   float value;
 };
 
-layout(buffer_reference) buffer Pointer
+layout(push_constant) uniform PC
 {
   Data data;
   gfx_glsl_texture2D tex;
-};
-
-layout(push_constant) uniform PC
-{
-  Pointer pointer;
-};
+} pc;
 
 layout(local_size_x = 2, local_size_y = 2) in;
 void main()
 {
   uvec2 gid = gl_GlobalInvocationID.xy;
-  pointer.data[gid.x + gid.y * gl_WorkGroupSize.x].value = texelFetch(pointer.tex, ivec2(gid), 0).r;
+  pc.data[gid.x + gid.y * gl_WorkGroupSize.x].value = texelFetch(pc.tex, ivec2(gid), 0).r;
 }
     )";
 
@@ -235,7 +231,15 @@ int main()
   gfx_vulkan_initialize(&initInfo);
 
   const auto result = CompileShaderToSpirv(shaderc_compute_shader, sShader);
+
+  // The first run is a cold start. Later runs load the driver's compiled pipelines from disk.
+  constexpr auto pipelineCachePath = "pipeline_cache.bin";
+  const bool warmStart = gfx_pipeline_cache_load(pipelineCachePath) == 0;
+  const auto pipelineStart = std::chrono::steady_clock::now();
   const auto pipeline = gfx_create_compute_pipeline({.ptr = result.binarySpv.data(), .size = result.binarySpv.size() * sizeof(uint32_t)});
+  const auto pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart);
+  std::println("{} pipeline creation: {:.3f} ms", warmStart ? "Warm" : "Cold", pipelineTime.count());
+  gfx_pipeline_cache_save(pipelineCachePath);
   
   const auto ToColor = [](uint8_t r, uint8_t g, uint8_t b, uint8_t a) -> uint32_t { return r | (g << 8) | (b << 16) | (a << 24); };
 
@@ -258,7 +262,7 @@ int main()
     }));
 
     gfx_cmd_init_discard_image(cmd, image);
-    gfx_cmd_barrier(cmd, GFX_STAGE_TRANSFER, GFX_ACCESS_ALL, GFX_STAGE_TRANSFER, GFX_ACCESS_ALL);
+    gfx_cmd_barrier(cmd, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_WRITE, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_WRITE);
     auto copy = gfx_copy_buffer_image_info{
       .buffer           = gfx_host_to_device_ptr(memory),
       .image            = image,
@@ -266,19 +270,22 @@ int main()
       .extent           = {2, 2, 1},
     };
     gfx_cmd_copy_buffer_to_image(cmd, &copy);
-    gfx_cmd_barrier(cmd, GFX_STAGE_TRANSFER, GFX_ACCESS_ALL, GFX_STAGE_COMPUTE, GFX_ACCESS_ALL);
+    gfx_cmd_barrier(cmd, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_WRITE, GFX_STAGE_COMPUTE, GFX_ACCESS_SHADER_SAMPLED_READ);
 
     struct PC
     {
       const void* data;
       uint32_t descriptor;
     };
-    auto* pc = static_cast<PC*>(gfx_malloc(sizeof(PC)));
-    auto* output = static_cast<float*>(gfx_malloc(sizeof(float) * 4));
+    const auto outputAllocation = gfx_malloc_ex(sizeof(float) * 4, GFX_MEMORY_USAGE_READBACK);
+    auto* output = static_cast<float*>(outputAllocation.host_ptr);
 
-    pc->data   = gfx_host_to_device_ptr(output);
-    pc->descriptor = gfx_get_sampled_image_descriptor(image).index;
-    gfx_cmd_dispatch(cmd, pipeline, 1, 1, 1, gfx_host_to_device_ptr(pc));
+    const auto pc = PC{
+      .data       = outputAllocation.device_ptr,
+      .descriptor = gfx_get_sampled_image_descriptor(image).index,
+    };
+    gfx_cmd_dispatch_inline(cmd, pipeline, 1, 1, 1, &pc, sizeof(pc));
+    gfx_cmd_barrier(cmd, GFX_STAGE_COMPUTE, GFX_ACCESS_SHADER_STORAGE_WRITE, GFX_STAGE_HOST, GFX_ACCESS_HOST_READ);
 
     auto token = gfx_submit(cmd, nullptr, 0);
     gfx_wait_submit(token);
@@ -288,8 +295,7 @@ int main()
 
     gfx_destroy_image(image);
 
-    gfx_free(output);
-    gfx_free(pc);
+    gfx_free_ex(outputAllocation);
     gfx_free(memory);
   }
 
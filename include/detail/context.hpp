@@ -2,20 +2,53 @@
 #include "gfx2_vulkan.h"
 #include "vk_mem_alloc.h"
 #include "vulkan/vulkan_core.h"
+#include "detail/tracking.hpp"
 
 #include <cassert>
-#include <stack>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+namespace gfx2::internal
+{
+  struct CommandPools;
+}
+
 struct gfx_compute_pipeline_t
 {
   VkPipeline pipeline;
+  uint32_t refCount;
+  std::string key; // SPIR-V and specialization constants; identifies the pipeline in Context::computePipelines.
 };
 
 struct gfx_command_buffer_t
 {
   gfx_queue queue;
   VkCommandBuffer cmd;
+  uint64_t submitValue; // Zero until submitted.
+  bool ended;           // Set by gfx_end_command_buffer, or by the submit if it was not called.
+  gfx2::internal::CommandPools* pools;
+
+  // State bound so far in this recording, so redundant binds can be skipped.
+  VkPipeline boundComputePipeline;
+  bool descriptorSetBound;
+
+  // Barriers recorded since the last command. They are flushed together right before the next command that could depend on them.
+  std::vector<VkMemoryBarrier2> pendingMemoryBarriers;
+  std::vector<VkImageMemoryBarrier2> pendingImageBarriers;
+
+  std::optional<gfx2::internal::HazardTracker> hazardTracker; // Set by gfx_enable_hazard_tracking.
 };
 
 struct gfx_semaphore_t
@@ -30,20 +63,79 @@ namespace gfx2::internal
     uintptr_t begin;
     uintptr_t end;
     VkDeviceAddress deviceAddress;
+    VkDeviceSize size; // Also valid when the memory is not host-visible and begin == end == 0.
     VmaAllocation allocation;
     VkBuffer buffer;
+    VkDeviceSize bufferOffset; // Offset of begin in buffer.
+    VmaVirtualBlock virtualBlock; // Non-null if the allocation was carved out of a MemoryBlock.
+    VmaVirtualAllocation virtualAllocation;
+  };
+
+  // A large persistently mapped buffer that small allocations are sub-allocated from.
+  struct MemoryBlock
+  {
+    VkBuffer buffer;
+    VmaAllocation allocation;
+    uintptr_t hostAddress;
+    VkDeviceAddress deviceAddress;
+    VmaVirtualBlock virtualBlock;
   };
 
+  // Live allocations indexed by both their host and device address ranges.
+  // Ranges never overlap, so the mapping containing an address is the one with the greatest begin that is <= the address.
+  // Recording threads look addresses up while the application thread allocates and frees, so lookups are shared and changes exclusive.
   struct MemoryMappings
   {
-    std::vector<MemoryMapping> mappings;
+    std::map<uintptr_t, MemoryMapping> hostToMapping;
+    std::map<VkDeviceAddress, MemoryMapping> deviceToMapping;
+    mutable std::shared_mutex mutex;
+
+    // Mappings of memory that is not host-visible have begin == 0 and are only indexed by device address.
+    void Insert(const MemoryMapping& mapping)
+    {
+      auto lock = std::unique_lock(mutex);
+      if (mapping.begin != 0)
+      {
+        hostToMapping.emplace(mapping.begin, mapping);
+      }
+      deviceToMapping.emplace(mapping.deviceAddress, mapping);
+    }
+
+    MemoryMapping Erase(const void* ptr)
+    {
+      auto lock = std::unique_lock(mutex);
+      auto it   = hostToMapping.find(reinterpret_cast<uintptr_t>(ptr));
+      assert(it != hostToMapping.end());
+
+      const auto mapping = it->second;
+      hostToMapping.erase(it);
+      deviceToMapping.erase(mapping.deviceAddress);
+      return mapping;
+    }
+
+    MemoryMapping EraseDeviceAddress(const void* ptr)
+    {
+      auto lock = std::unique_lock(mutex);
+      auto it   = deviceToMapping.find(reinterpret_cast<VkDeviceAddress>(ptr));
+      assert(it != deviceToMapping.end());
+
+      const auto mapping = it->second;
+      deviceToMapping.erase(it);
+      if (mapping.begin != 0)
+      {
+        hostToMapping.erase(mapping.begin);
+      }
+      return mapping;
+    }
 
     VkDeviceAddress HostToDeviceAddress(const void* ptr) const
     {
+      auto lock       = std::shared_lock(mutex);
       const auto uPtr = reinterpret_cast<uintptr_t>(ptr);
-      for (const auto& mapping : mappings)
+      if (auto it = hostToMapping.upper_bound(uPtr); it != hostToMapping.begin())
       {
-        if (uPtr >= mapping.begin && uPtr < mapping.end)
+        const auto& mapping = std::prev(it)->second;
+        if (uPtr < mapping.end)
         {
           return mapping.deviceAddress + (uPtr - mapping.begin);
         }
@@ -55,10 +147,12 @@ namespace gfx2::internal
 
     MemoryMapping DeviceAddressToMapping(const void* ptr) const
     {
+      auto lock       = std::shared_lock(mutex);
       const auto uPtr = reinterpret_cast<uintptr_t>(ptr);
-      for (const auto& mapping : mappings)
+      if (auto it = deviceToMapping.upper_bound(uPtr); it != deviceToMapping.begin())
       {
-        if (uPtr >= mapping.deviceAddress && uPtr < mapping.deviceAddress + (mapping.end - mapping.begin))
+        const auto& mapping = std::prev(it)->second;
+        if (uPtr < mapping.deviceAddress + mapping.size)
         {
           return mapping;
         }
@@ -79,7 +173,62 @@ namespace gfx2::internal
     void Free(uint32_t index);
 
   private:
-    std::stack<uint32_t> freeSlots_;
+    // Indices at or above highWater_ have never been allocated and are implicitly free, so construction is O(1) and the bitsets grow on demand.
+    // A set bit in freeBits_ marks a free index below highWater_. A set bit in nonEmptyWords_ marks a word of freeBits_ with at least one free index,
+    // and a set bit in nonEmptySummaries_ marks a word of nonEmptyWords_ with at least one bit set.
+    std::vector<uint64_t> freeBits_;
+    std::vector<uint64_t> nonEmptyWords_;
+    std::vector<uint64_t> nonEmptySummaries_;
+    uint32_t highWater_  = 0;
+    uint32_t numIndices_ = 0;
+  };
+
+  struct RecycledCommandBuffer
+  {
+    VkCommandBuffer cmd;
+    uint64_t submitValue; // The command buffer can be reused once its queue's semaphore reaches this value.
+  };
+
+  // Command pools must be externally synchronized, so every thread that records commands gets its own set.
+  struct CommandPools
+  {
+    VkCommandPool pools[GFX_NUM_QUEUES];
+
+    // Command buffers may be destroyed on a different thread than the one that recorded them.
+    std::mutex recycledMutex;
+    std::vector<RecycledCommandBuffer> recycledCommandBuffers[GFX_NUM_QUEUES];
+  };
+
+  struct CompletionCallback
+  {
+    gfx_submit_callback callback;
+    void* userData;
+  };
+
+  // Waits on the queue semaphores in the background and runs the callbacks given to gfx_on_submit_complete.
+  // Started on first use. wakeSemaphore is signaled from the host to interrupt the wait when callbacks are added or on shutdown.
+  struct CompletionThread
+  {
+    std::thread thread;
+    std::mutex mutex;
+    bool stopRequested;
+    VkSemaphore wakeSemaphore;
+    uint64_t wakeValue;
+    std::multimap<uint64_t, CompletionCallback> callbacks[GFX_NUM_QUEUES];
+  };
+
+  struct DeferredDestruction
+  {
+    uint64_t semaphoreValues[GFX_NUM_QUEUES]; // The last values submitted to each queue when the object was destroyed.
+    std::function<void()> destroy;
+  };
+
+  struct PendingDescriptorWrite
+  {
+    uint32_t binding;
+    uint32_t index;
+    VkDescriptorType type;
+    VkDescriptorImageInfo imageInfo;
   };
 
   struct Context
@@ -92,25 +241,82 @@ namespace gfx2::internal
     uint32_t computeQueueFamilyIndex;
     uint32_t transferQueueFamilyIndex;
 
+    // The distinct families among the three above. Buffers and images are shared concurrently between them, or exclusive if there is only one.
+    uint32_t uniqueQueueFamilyIndices[GFX_NUM_QUEUES];
+    uint32_t numUniqueQueueFamilies;
+    VkSharingMode sharingMode;
+
     MemoryMappings memoryMappings;
+    std::vector<MemoryBlock> memoryBlocks[GFX_NUM_MEMORY_USAGES];
     IndexAllocator sampledImageDescriptorAllocator;
     IndexAllocator storageImageDescriptorAllocator;
     IndexAllocator samplerDescriptorAllocator;
 
+    bool deferDestruction;
+    std::deque<DeferredDestruction> deferredDestructions; // Semaphore values are nondecreasing from front to back.
+    std::mutex postedReleasesMutex;
+    std::vector<std::function<void()>> postedReleases; // Releases called from completion callbacks, run by the next submit.
+
     gfx_semaphore_t semaphores[GFX_NUM_QUEUES];
     uint64_t semaphoreValues[GFX_NUM_QUEUES];
+    CompletionThread completionThread;
     VmaAllocator allocator;
-    VkCommandPool commandPools[GFX_NUM_QUEUES];
+    std::mutex commandPoolsMutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<CommandPools>> commandPools;
     VkDescriptorPool descriptorPool;
     VkDescriptorSetLayout commonDescriptorSetLayout;
     VkDescriptorSet descriptorSet;
+    std::vector<PendingDescriptorWrite> pendingDescriptorWrites;
     VkPipelineLayout commonPipelineLayout;
+    VkPipelineCache pipelineCache;
+    std::shared_mutex pipelineCacheMutex; // Creating pipelines holds it shared. Merging into the cache and reading its data hold it exclusively.
+    std::mutex computePipelinesMutex;
+    std::unordered_map<std::string_view, gfx_compute_pipeline> computePipelines; // Keys view gfx_compute_pipeline_t::key.
 
     static constexpr uint32_t STORAGE_IMAGE_BINDING = 0;
     static constexpr uint32_t SAMPLED_IMAGE_BINDING = 1;
     static constexpr uint32_t SAMPLER = 2;
+
+    // Allocations up to this size share a MemoryBlock instead of getting their own VkBuffer.
+    static constexpr VkDeviceSize MAX_SUBALLOCATION_SIZE  = 64 * 1024;
+    static constexpr VkDeviceSize MEMORY_BLOCK_SIZE       = 16 * 1024 * 1024;
+    static constexpr VkDeviceSize SUBALLOCATION_ALIGNMENT = 16;
   };
 
+  // Creates a buffer with a device address, persistently mapped unless usage is GFX_MEMORY_USAGE_GPU_ONLY. The returned block has no virtual block.
+  MemoryBlock CreateBuffer(const Context& ctx, VkDeviceSize size, gfx_memory_usage usage);
+
+  // Returns the calling thread's command pools, creating them on first use.
+  CommandPools& GetThreadCommandPools(Context& ctx);
+
+  // Writes all queued descriptors with a single vkUpdateDescriptorSets call.
+  void FlushDescriptorWrites(Context& ctx);
+
+  // Runs all outstanding completion callbacks, then joins the completion thread if it was started.
+  void StopCompletionThread(Context& ctx);
+
+  // Calls destroy immediately, or queues it until the GPU has finished all submitted work if deferred destruction is enabled.
+  void DeferDestruction(Context& ctx, std::function<void()> destroy);
+
+  // Runs queued destructions whose work has finished. If wait is true, first waits for all submitted work.
+  void CollectDeferredDestructions(Context& ctx, bool wait);
+
+  bool IsCompletionThread();
+
+  // Release entry points start with this. On the completion thread it queues release for the next submit and returns true, so completion
+  // callbacks never touch the allocators, mappings or deferred destructions while another thread is using them. Elsewhere it returns false.
+  bool PostFromCompletionThread(Context& ctx, std::function<void()> release);
+
+  // Runs the releases posted by completion callbacks.
+  void RunPostedReleases(Context& ctx);
+
+  bool IsSubmitComplete(const Context& ctx, gfx_submit_token token);
+
+  HazardTracker::Resource ToTrackedResource(const gfx_resource_use& use);
+
+  // Tracks the uses as accesses from stage and queues the barrier they need. The command buffer must have hazard tracking enabled.
+  void TrackResourceUses(gfx_command_buffer commandBuffer, std::span<const gfx_resource_use> uses, gfx_stage_flags stage);
+
   void CreateContextInstance(const gfx_vulkan_init_info& info);
   void DestroyContextInstance();
   Context& GetContextInstance();
@@ -0,0 +1,40 @@
+#pragma once
+#include "vulkan/vulkan_core.h"
+
+#include <vector>
+
+namespace gfx2::internal
+{
+  // Remembers how a command buffer last accessed each resource and works out the barrier each new access needs.
+  // Images are tracked as a whole and are always in the general layout, so a global memory barrier is enough for them too.
+  class HazardTracker
+  {
+  public:
+    // Either an image (whole, identified by its internal image so views share state) or a range of device addresses.
+    struct Resource
+    {
+      const void* image;
+      VkDeviceAddress begin;
+      VkDeviceAddress end;
+    };
+
+    static bool Overlaps(const Resource& a, const Resource& b);
+
+    // Records an access and adds whatever it has to wait for to barrier. All accesses of one command should share a barrier.
+    void Access(const Resource& resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkMemoryBarrier2& barrier);
+
+  private:
+    struct ResourceState
+    {
+      Resource resource;
+      VkPipelineStageFlags2 writeStages; // The last write, if there was one.
+      VkAccessFlags2 writeAccess;
+      VkPipelineStageFlags2 visibleStages; // Where the last write has been made visible so far.
+      VkAccessFlags2 visibleAccess;
+      VkPipelineStageFlags2 readStages; // Stages that read since the last write.
+    };
+
+    // Partially overlapping states are updated as if the access covered them entirely, which can only add barriers, never drop one.
+    std::vector<ResourceState> states_;
+  };
+} // namespace gfx2::internal
\ No newline at end of file
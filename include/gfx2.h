@@ -37,17 +37,40 @@ typedef enum gfx_stage_flag_bits
   GFX_STAGE_COMPUTE = 1 << 5,
 
   GFX_STAGE_TRANSFER = 1 << 6,
+
+  GFX_STAGE_DRAW_INDIRECT = 1 << 7, // Where indirect arguments (including gfx_cmd_dispatch_indirect's) are read.
+  GFX_STAGE_HOST          = 1 << 8, // Only meaningful in barriers that make device writes visible to host reads after a wait.
 } gfx_stage_flag_bits;
 typedef gfx_flags_t gfx_stage_flags;
 
+// GFX_ACCESS_READ and GFX_ACCESS_WRITE cover every kind of access. The specific bits let drivers flush and invalidate only the caches involved.
+// Loads and stores through device addresses (gfx_malloc memory) are storage accesses.
 typedef enum gfx_access_flag_bits
 {
   GFX_ACCESS_ALL   = 0x7FFFFFFF,
   GFX_ACCESS_READ  = 1 << 0,
   GFX_ACCESS_WRITE = 1 << 1,
+
+  GFX_ACCESS_SHADER_STORAGE_READ  = 1 << 2,
+  GFX_ACCESS_SHADER_STORAGE_WRITE = 1 << 3,
+  GFX_ACCESS_SHADER_SAMPLED_READ  = 1 << 4,
+  GFX_ACCESS_UNIFORM_READ         = 1 << 5,
+  GFX_ACCESS_INDIRECT_READ        = 1 << 6,
+  GFX_ACCESS_TRANSFER_READ        = 1 << 7,
+  GFX_ACCESS_TRANSFER_WRITE       = 1 << 8,
+  GFX_ACCESS_HOST_READ            = 1 << 9,
+  GFX_ACCESS_HOST_WRITE           = 1 << 10,
 } gfx_access_flag_bits;
 typedef gfx_flags_t gfx_access_flags;
 
+typedef enum gfx_wait_mode
+{
+  GFX_WAIT_ALL,
+  GFX_WAIT_ANY,
+} gfx_wait_mode;
+
+#define GFX_TIMEOUT_INFINITE UINT64_MAX
+
 typedef enum gfx_image_type
 {
   GFX_IMAGE_TYPE_1D,
@@ -155,14 +178,38 @@ typedef enum gfx_aspect_flag_bits
   GFX_ASPECT_STENCIL,
 } gfx_aspect_flag_bits;
 
+typedef enum gfx_memory_usage
+{
+  // Host-visible memory that the CPU writes sequentially, preferably device-local. This is what gfx_malloc uses.
+  GFX_MEMORY_USAGE_DEFAULT,
+  // Device-local memory that the CPU never touches. Keeps large buffers out of the small host-visible device-local heap.
+  GFX_MEMORY_USAGE_GPU_ONLY,
+  // Host memory that the CPU writes sequentially, for staging uploads.
+  GFX_MEMORY_USAGE_UPLOAD,
+  // Host-cached memory for reading back GPU results on the CPU.
+  GFX_MEMORY_USAGE_READBACK,
+  // Host-visible memory that the CPU reads and writes in any order, preferably device-local.
+  GFX_MEMORY_USAGE_RANDOM_ACCESS,
+
+  GFX_NUM_MEMORY_USAGES,
+} gfx_memory_usage;
+
 #define GFX_REMAINING_MIP_LEVELS (~0u)
 #define GFX_REMAINING_ARRAY_LAYERS (~0u)
+// The size of the push constant range every pipeline shares. Vulkan guarantees at least this much.
+#define GFX_MAX_INLINE_ARGS_SIZE 128u
 
 // Opaque handles.
 typedef struct gfx_command_buffer_t* gfx_command_buffer;
 typedef struct gfx_semaphore_t* gfx_semaphore;
 typedef struct gfx_compute_pipeline_t* gfx_compute_pipeline;
 typedef struct gfx_image_t* gfx_image;
+typedef struct gfx_arena_t* gfx_arena;
+typedef struct gfx_pipeline_build_t* gfx_pipeline_build;
+typedef struct gfx_graph_t* gfx_graph;
+
+typedef void (*gfx_submit_callback)(void* user_data);
+typedef void (*gfx_pass_callback)(gfx_command_buffer command_buffer, void* user_data);
 
 typedef struct gfx_offset_2D
 {
@@ -190,6 +237,32 @@ typedef struct gfx_submit_token
   uint64_t value;
 } gfx_submit_token;
 
+typedef struct gfx_allocation
+{
+  void* host_ptr; // NULL if the memory is not host-visible.
+  void* device_ptr;
+} gfx_allocation;
+
+typedef struct gfx_submit_wait
+{
+  gfx_submit_token token;
+  gfx_stage_flags stage; // The stages of the submission that wait for the token.
+} gfx_submit_wait;
+
+// Overrides a 32-bit specialization constant (bool, int, uint or float bits). This includes workgroup sizes declared with local_size_x_id and friends.
+typedef struct gfx_specialization_constant
+{
+  uint32_t id;
+  uint32_t value;
+} gfx_specialization_constant;
+
+typedef struct gfx_compute_pipeline_create_info
+{
+  gfx_byte_span code;
+  const gfx_specialization_constant* specialization_constants;
+  uint32_t num_specialization_constants;
+} gfx_compute_pipeline_create_info;
+
 typedef struct gfx_image_create_info
 {
   gfx_image_type type;
@@ -240,31 +313,147 @@ typedef struct gfx_copy_buffer_image_info
   uint32_t image_height;
 } gfx_copy_buffer_image_info;
 
+// A resource accessed by a dispatch, for command buffers with hazard tracking. Set either image or device_ptr.
+typedef struct gfx_resource_use
+{
+  gfx_image image;
+  const void* device_ptr; // Device address of gfx_malloc'd memory.
+  uint64_t size;          // Bytes from device_ptr. Zero means the rest of the allocation.
+  gfx_access_flags access;
+} gfx_resource_use;
+
+typedef struct gfx_pass_info
+{
+  gfx_queue queue;
+  const gfx_resource_use* uses; // Everything the pass reads or writes. Uses with any write access bit are writes.
+  uint32_t num_uses;
+  gfx_pass_callback record;
+  void* user_data;
+  int has_side_effects; // Set for passes whose results are consumed outside the graph, such as by the host. Other passes are culled unless they feed one.
+} gfx_pass_info;
+
 gfx_image gfx_create_image(const gfx_image_create_info* create_info);
+void gfx_create_images(const gfx_image_create_info* create_infos, uint32_t count, gfx_image* images);
 gfx_image gfx_create_image_view(const gfx_image_view_create_info* create_info);
 void gfx_destroy_image(gfx_image image);
 gfx_sampled_image_descriptor gfx_get_sampled_image_descriptor(gfx_image image);
 gfx_storage_image_descriptor gfx_get_storage_image_descriptor(gfx_image image);
 
+// Image descriptors are written lazily. They are flushed automatically by gfx_submit, so this is only needed when descriptors must be visible before then.
+void gfx_flush_descriptor_writes();
+
+// Command buffers can be created and recorded on any number of threads concurrently, but each must be recorded by the thread that created it.
+// Recording may overlap with gfx_malloc, gfx_free and arena use on other threads. gfx_submit must still be externally synchronized.
 gfx_command_buffer gfx_create_command_buffer(gfx_queue queue);
 void gfx_destroy_command_buffer(gfx_command_buffer command_buffer);
 
+// Finishes recording. Submitting ends the command buffer if this was not called, but ending uses the recording thread's command pool,
+// so a command buffer that is submitted from another thread must be ended by the thread that recorded it first.
+void gfx_end_command_buffer(gfx_command_buffer command_buffer);
+
+// Makes the command buffer insert the barriers between its own commands. Copies, indirect argument reads and gfx_cmd_init_discard_image are
+// tracked on their own; dispatches access what gfx_cmd_use_resources declared for them. Must be called before anything is recorded.
+// Dependencies on other submissions are still expressed by waiting on their tokens.
+void gfx_enable_hazard_tracking(gfx_command_buffer command_buffer);
+
+// Waits on every token with, and signals after, all stages.
 gfx_submit_token gfx_submit(gfx_command_buffer command_buffer, const gfx_submit_token* wait_tokens, uint32_t num_wait_tokens);
 
+// Like gfx_submit, but each wait only blocks the stages it names so earlier stages can overlap with other queues.
+// The returned token is signaled once signal_stage has completed, so signal_stage must include every stage the submission uses.
+gfx_submit_token gfx_submit_ex(gfx_command_buffer command_buffer, const gfx_submit_wait* waits, uint32_t num_waits, gfx_stage_flags signal_stage);
+
+// Submits command buffers for the same queue with a single queue submission. The returned token completes when all of them have.
+gfx_submit_token gfx_submit_batch(const gfx_command_buffer* command_buffers,
+  uint32_t num_command_buffers,
+  const gfx_submit_wait* waits,
+  uint32_t num_waits,
+  gfx_stage_flags signal_stage);
+
 void gfx_wait_submit(gfx_submit_token token);
 
+// Returns nonzero if the GPU has finished the submission. Never blocks.
+int gfx_is_submit_complete(gfx_submit_token token);
+
+// Waits until all or any of the tokens complete. Returns nonzero on completion and zero if timeout_ns elapsed first.
+int gfx_wait_submits(const gfx_submit_token* tokens, uint32_t num_tokens, gfx_wait_mode mode, uint64_t timeout_ns);
+
+// Calls callback once the GPU has finished the submission. Callbacks run on a thread owned by the library, in timeline order per queue, so they must synchronize their own use of the API.
+// The exception is releasing resources: gfx_free, gfx_free_ex, gfx_destroy_image, gfx_destroy_compute_pipeline and gfx_destroy_arena may be called
+// from a callback, in which case the release is carried out by the next submit (or at shutdown).
+// Callbacks still pending at shutdown are run after their submissions complete.
+void gfx_on_submit_complete(gfx_submit_token token, gfx_submit_callback callback, void* user_data);
+
+// Creating a pipeline with the same SPIR-V and specialization constants as a live one returns that pipeline with its reference count incremented.
+// Every create must be paired with a gfx_destroy_compute_pipeline; the pipeline is destroyed when the last reference is released.
 gfx_compute_pipeline gfx_create_compute_pipeline(gfx_byte_span code);
+gfx_compute_pipeline gfx_create_compute_pipeline_ex(const gfx_compute_pipeline_create_info* create_info);
 void gfx_destroy_compute_pipeline(gfx_compute_pipeline pipeline);
 
+// Creates count pipelines, spreading the work across threads.
+void gfx_create_compute_pipelines(const gfx_compute_pipeline_create_info* create_infos, uint32_t count, gfx_compute_pipeline* pipelines);
+
+// Like gfx_create_compute_pipelines, but returns immediately. The SPIR-V and specialization constants the create infos point to must stay valid until the build is finished.
+// gfx_finish_pipeline_build waits if necessary, writes the pipelines and destroys the handle.
+gfx_pipeline_build gfx_create_compute_pipelines_async(const gfx_compute_pipeline_create_info* create_infos, uint32_t count);
+int gfx_is_pipeline_build_complete(gfx_pipeline_build build);
+void gfx_finish_pipeline_build(gfx_pipeline_build build, gfx_compute_pipeline* pipelines);
+
+// Pipelines are created through a cache owned by the context. Saving it and loading it on the next run skips driver compilation of pipelines seen before.
+// Loading returns nonzero, without touching the cache, if the file is missing, truncated or was written by a different device or driver version.
+// Both are safe to call while pipelines are being created on other threads.
+gfx_error_t gfx_pipeline_cache_save(const char* path);
+gfx_error_t gfx_pipeline_cache_load(const char* path);
+
+// Barriers (including gfx_cmd_init_discard_image's) are batched and recorded together right before the next dispatch, copy or submit.
 void gfx_cmd_barrier(gfx_command_buffer command_buffer, gfx_stage_flags srcStage, gfx_access_flags srcAccess, gfx_stage_flags dstStage, gfx_access_flags dstAccess);
 void gfx_cmd_dispatch(gfx_command_buffer command_buffer, gfx_compute_pipeline pipeline, uint32_t x, uint32_t y, uint32_t z, const void* args);
+// Copies args_size bytes of args into push constants instead of passing a pointer, saving an allocation and a dependent load in the shader.
+// args_size must be a nonzero multiple of 4 and at most GFX_MAX_INLINE_ARGS_SIZE. The shader declares the struct directly as its push_constant block.
+void gfx_cmd_dispatch_inline(gfx_command_buffer command_buffer, gfx_compute_pipeline pipeline, uint32_t x, uint32_t y, uint32_t z, const void* args, uint32_t args_size);
+// Dispatches workgroups starting at (base_x, base_y, base_z). gl_WorkGroupID and gl_GlobalInvocationID include the base, which makes tiled dispatches possible without extra arguments.
+void gfx_cmd_dispatch_base(gfx_command_buffer command_buffer,
+  gfx_compute_pipeline pipeline,
+  uint32_t base_x,
+  uint32_t base_y,
+  uint32_t base_z,
+  uint32_t x,
+  uint32_t y,
+  uint32_t z,
+  const void* args);
+// Reads the workgroup counts as three uint32_ts at device_args_ptr, a 4-byte aligned device address of gfx_malloc'd memory.
+void gfx_cmd_dispatch_indirect(gfx_command_buffer command_buffer, gfx_compute_pipeline pipeline, const void* device_args_ptr, const void* args);
 void gfx_cmd_init_discard_image(gfx_command_buffer command_buffer, gfx_image image);
+// Declares the resources the next dispatch accesses from the compute stage. Does nothing unless hazard tracking is enabled.
+void gfx_cmd_use_resources(gfx_command_buffer command_buffer, const gfx_resource_use* uses, uint32_t num_uses);
 void gfx_cmd_copy_buffer_to_image(gfx_command_buffer command_buffer, const gfx_copy_buffer_image_info* info);
 void gfx_cmd_copy_image_to_buffer(gfx_command_buffer command_buffer, const gfx_copy_buffer_image_info* info);
 
 void* gfx_malloc(size_t bytes);
 void gfx_free(void* ptr);
 void* gfx_host_to_device_ptr(void* ptr);
+gfx_allocation gfx_malloc_ex(size_t bytes, gfx_memory_usage usage);
+void gfx_free_ex(gfx_allocation allocation);
+
+// A graph schedules passes across queues. Passes may only depend on passes added before them, so insertion order is a valid execution order.
+// On execution, passes that feed no pass with side effects are culled. Each remaining pass is recorded into a command buffer with hazard tracking
+// for its queue, with one batched barrier before it for its declared uses. Consecutive passes on a queue share a command buffer until one has to
+// wait for another submission; timeline waits are only added where a pass depends on a pass in another submission.
+// The graph keeps the passes and can be executed again. gfx_execute_graph submits, so it must be externally synchronized like gfx_submit.
+gfx_graph gfx_create_graph();
+void gfx_destroy_graph(gfx_graph graph);
+void gfx_graph_add_pass(gfx_graph graph, const gfx_pass_info* info);
+// waits apply to the first submission on each queue. tokens receives GFX_NUM_QUEUES tokens, one per queue, each complete once the queue has
+// finished its part of the graph (and everything it was given before).
+void gfx_execute_graph(gfx_graph graph, const gfx_submit_wait* waits, uint32_t num_waits, gfx_submit_token* tokens);
+
+// Arenas hand out transient memory with a bump pointer. Pointers returned by gfx_arena_alloc work with gfx_host_to_device_ptr, but must not be passed to gfx_free.
+// gfx_arena_reset_after releases everything allocated since the last reset once the GPU has passed token.
+// Arenas must be reset before they are destroyed. gfx_destroy_arena keeps the memory alive until the GPU has passed every reset token.
+gfx_arena gfx_create_arena(size_t chunk_size);
+void gfx_destroy_arena(gfx_arena arena);
+void* gfx_arena_alloc(gfx_arena arena, size_t bytes);
+void gfx_arena_reset_after(gfx_arena arena, gfx_submit_token token);
 
 
 #ifdef __cplusplus
@@ -24,6 +24,8 @@ typedef struct gfx_vulkan_init_info
   uint32_t graphicsQueueFamilyIndex;
   uint32_t computeQueueFamilyIndex;
   uint32_t transferQueueFamilyIndex;
+  // If nonzero, destroyed images, pipelines and allocations are kept alive until the GPU finishes all work submitted before the destroy call.
+  int deferDestruction;
 } gfx_vulkan_init_info;
 
 gfx_error_t gfx_vulkan_initialize(const gfx_vulkan_init_info* initInfo);
@@ -0,0 +1,139 @@
+#include "gfx2.h"
+#include "detail/common.hpp"
+#include "detail/context.hpp"
+
+#include <cassert>
+#include <vector>
+
+using namespace gfx2::internal;
+
+struct gfx_arena_t
+{
+  struct Chunk
+  {
+    MemoryBlock buffer;
+    gfx_submit_token retireToken;
+  };
+
+  size_t chunkSize;
+  size_t offset;
+  std::vector<Chunk> chunks;
+  std::vector<uint32_t> activeChunks;  // Used since the last reset. The back is the one being bumped.
+  std::vector<uint32_t> retiredChunks; // Waiting for their retire token to complete.
+  std::vector<uint32_t> freeChunks;
+};
+
+namespace
+{
+  uint32_t AcquireChunk(gfx_arena arena)
+  {
+    auto& ctx = GetContextInstance();
+
+    std::erase_if(arena->retiredChunks,
+      [&](uint32_t index)
+      {
+        if (IsSubmitComplete(ctx, arena->chunks[index].retireToken))
+        {
+          arena->freeChunks.push_back(index);
+          return true;
+        }
+        return false;
+      });
+
+    if (!arena->freeChunks.empty())
+    {
+      const auto index = arena->freeChunks.back();
+      arena->freeChunks.pop_back();
+      return index;
+    }
+
+    const auto buffer = CreateBuffer(ctx, arena->chunkSize, GFX_MEMORY_USAGE_DEFAULT);
+
+    // The whole chunk is a single mapping so any pointer inside it can be translated.
+    ctx.memoryMappings.Insert(MemoryMapping{
+      .begin         = buffer.hostAddress,
+      .end           = buffer.hostAddress + arena->chunkSize,
+      .deviceAddress = buffer.deviceAddress,
+      .size          = arena->chunkSize,
+      .allocation    = buffer.allocation,
+      .buffer        = buffer.buffer,
+      .bufferOffset  = 0,
+    });
+
+    arena->chunks.push_back({.buffer = buffer});
+    return static_cast<uint32_t>(arena->chunks.size() - 1);
+  }
+} // namespace
+
+gfx_arena gfx_create_arena(size_t chunk_size)
+{
+  assert(chunk_size > 0);
+
+  auto* arena      = new gfx_arena_t{};
+  arena->chunkSize = chunk_size;
+  return arena;
+}
+
+void gfx_destroy_arena(gfx_arena arena)
+{
+  assert(arena);
+  assert(arena->activeChunks.empty()); // Active chunks have no retire token yet, so gfx_arena_reset_after must come first.
+  auto& ctx = GetContextInstance();
+  if (PostFromCompletionThread(ctx, [arena] { gfx_destroy_arena(arena); }))
+  {
+    return;
+  }
+
+  // Retired chunks may still be read by the GPU. DeferDestruction covers them when it is enabled, as the queue values it captures are at least
+  // as far along as any retire token. Otherwise it destroys right away, so wait for the tokens here.
+  if (!ctx.deferDestruction)
+  {
+    for (auto index : arena->retiredChunks)
+    {
+      const auto& token = arena->chunks[index].retireToken;
+      if (!IsSubmitComplete(ctx, token))
+      {
+        gfx_wait_submit(token);
+      }
+    }
+  }
+
+  for (const auto& chunk : arena->chunks)
+  {
+    ctx.memoryMappings.Erase(reinterpret_cast<const void*>(chunk.buffer.hostAddress));
+    DeferDestruction(ctx, [&ctx, buffer = chunk.buffer] { vmaDestroyBuffer(ctx.allocator, buffer.buffer, buffer.allocation); });
+  }
+
+  delete arena;
+}
+
+void* gfx_arena_alloc(gfx_arena arena, size_t bytes)
+{
+  assert(bytes > 0);
+  assert(bytes <= arena->chunkSize);
+
+  constexpr auto alignment = Context::SUBALLOCATION_ALIGNMENT;
+  auto offset              = (arena->offset + alignment - 1) & ~(alignment - 1);
+
+  if (arena->activeChunks.empty() || offset + bytes > arena->chunkSize)
+  {
+    arena->activeChunks.push_back(AcquireChunk(arena));
+    offset = 0;
+  }
+
+  arena->offset = offset + bytes;
+
+  return reinterpret_cast<void*>(arena->chunks[arena->activeChunks.back()].buffer.hostAddress + offset);
+}
+
+void gfx_arena_reset_after(gfx_arena arena, gfx_submit_token token)
+{
+  for (auto index : arena->activeChunks)
+  {
+    arena->chunks[index].retireToken = token;
+    arena->retiredChunks.push_back(index);
+  }
+
+  arena->activeChunks.clear();
+  arena->offset = 0;
+}
\ No newline at end of file
@@ -3,12 +3,20 @@
 #include "detail/context.hpp"
 #include "detail/image.hpp"
 
+#include <algorithm>
+#include <mutex>
+#include <span>
 #include <vector>
 
 namespace
 {
   VkPipelineStageFlags2 ToVkStageFlags(gfx_stage_flags inFlags)
   {
+    if (inFlags == GFX_STAGE_ALL)
+    {
+      return VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    }
+
     auto flags = VkPipelineStageFlags2{};
 
     flags |= inFlags & GFX_STAGE_VERTEX_SHADER ? VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT : 0;
@@ -18,20 +26,190 @@ namespace
     flags |= inFlags & GFX_STAGE_FRAGMENT_SHADER_OUTPUT ? VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT : 0;
     flags |= inFlags & GFX_STAGE_COMPUTE ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT : 0;
     flags |= inFlags & GFX_STAGE_TRANSFER ? VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT : 0;
+    flags |= inFlags & GFX_STAGE_DRAW_INDIRECT ? VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT : 0;
+    flags |= inFlags & GFX_STAGE_HOST ? VK_PIPELINE_STAGE_2_HOST_BIT : 0;
 
     return flags;
   }
 
   VkAccessFlags2 ToVkAccessFlags(gfx_access_flags inFlags)
   {
+    if (inFlags == GFX_ACCESS_ALL)
+    {
+      return VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+    }
+
     auto flags = VkAccessFlags2{};
 
     flags |= inFlags & GFX_ACCESS_READ ? VK_ACCESS_2_MEMORY_READ_BIT : 0;
     flags |= inFlags & GFX_ACCESS_WRITE ? VK_ACCESS_2_MEMORY_WRITE_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_SHADER_STORAGE_READ ? VK_ACCESS_2_SHADER_STORAGE_READ_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_SHADER_STORAGE_WRITE ? VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_SHADER_SAMPLED_READ ? VK_ACCESS_2_SHADER_SAMPLED_READ_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_UNIFORM_READ ? VK_ACCESS_2_UNIFORM_READ_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_INDIRECT_READ ? VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_TRANSFER_READ ? VK_ACCESS_2_TRANSFER_READ_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_TRANSFER_WRITE ? VK_ACCESS_2_TRANSFER_WRITE_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_HOST_READ ? VK_ACCESS_2_HOST_READ_BIT : 0;
+    flags |= inFlags & GFX_ACCESS_HOST_WRITE ? VK_ACCESS_2_HOST_WRITE_BIT : 0;
 
     return flags;
   }
 
+  // Barriers in one dependency are unordered. A new barrier whose source stages overlap a pending barrier's destination stages would have
+  // chained onto it, so the pending destination scope is widened to the new one's, and the new source scope to the pending one's.
+  // The latter orders the new barrier's layout transition, if any, after the pending barrier's source.
+  template<typename Barrier>
+  void ChainPendingBarriers(gfx_command_buffer commandBuffer, Barrier& newBarrier)
+  {
+    const auto srcStage = newBarrier.srcStageMask;
+    const auto chain    = [&newBarrier, srcStage](auto& pending)
+    {
+      if ((pending.dstStageMask & srcStage) != 0 || pending.dstStageMask == VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT ||
+          srcStage == VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT)
+      {
+        pending.dstStageMask |= newBarrier.dstStageMask;
+        pending.dstAccessMask |= newBarrier.dstAccessMask;
+        newBarrier.srcStageMask |= pending.srcStageMask;
+        newBarrier.srcAccessMask |= pending.srcAccessMask;
+      }
+    };
+
+    std::ranges::for_each(commandBuffer->pendingMemoryBarriers, chain);
+    std::ranges::for_each(commandBuffer->pendingImageBarriers, chain);
+  }
+
+  // Queues the barrier that a command's tracked accesses added up to, if they need one.
+  void QueueTrackedBarrier(gfx_command_buffer commandBuffer, VkMemoryBarrier2 barrier)
+  {
+    if (barrier.srcStageMask == 0)
+    {
+      return;
+    }
+
+    ChainPendingBarriers(commandBuffer, barrier);
+    commandBuffer->pendingMemoryBarriers.push_back(barrier);
+  }
+
+  // A size of zero extends the range to the end of the allocation.
+  gfx2::internal::HazardTracker::Resource ToTrackedRange(const void* devicePtr, VkDeviceSize size)
+  {
+    auto& ctx          = gfx2::internal::GetContextInstance();
+    const auto mapping = ctx.memoryMappings.DeviceAddressToMapping(devicePtr);
+    const auto begin   = reinterpret_cast<VkDeviceAddress>(devicePtr);
+    return {.image = nullptr, .begin = begin, .end = size != 0 ? begin + size : mapping.deviceAddress + mapping.size};
+  }
+
+  gfx2::internal::HazardTracker::Resource ToTrackedImage(gfx_image image)
+  {
+    return {.image = image->internalImage.get(), .begin = 0, .end = 0};
+  }
+
+  // Records every pending barrier with one vkCmdPipelineBarrier2, so back-to-back barriers cost a single pipeline drain.
+  void FlushBarriers(gfx_command_buffer commandBuffer)
+  {
+    if (commandBuffer->pendingMemoryBarriers.empty() && commandBuffer->pendingImageBarriers.empty())
+    {
+      return;
+    }
+
+    vkCmdPipelineBarrier2(commandBuffer->cmd,
+      ToPtr(VkDependencyInfo{
+        .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount      = static_cast<uint32_t>(commandBuffer->pendingMemoryBarriers.size()),
+        .pMemoryBarriers         = commandBuffer->pendingMemoryBarriers.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(commandBuffer->pendingImageBarriers.size()),
+        .pImageMemoryBarriers    = commandBuffer->pendingImageBarriers.data(),
+      }));
+
+    commandBuffer->pendingMemoryBarriers.clear();
+    commandBuffer->pendingImageBarriers.clear();
+  }
+
+  // Submits are externally synchronized, so one scratch array per thread lets them avoid allocating.
+  std::vector<VkSemaphoreSubmitInfo>& GetWaitSemaphoreInfos()
+  {
+    thread_local auto waitSemaphoreInfos = std::vector<VkSemaphoreSubmitInfo>();
+    waitSemaphoreInfos.clear();
+    return waitSemaphoreInfos;
+  }
+
+  // Submits all command buffers to their (shared) queue in one batch that signals a single timeline value.
+  gfx_submit_token Submit(std::span<const gfx_command_buffer> commandBuffers, std::span<const VkSemaphoreSubmitInfo> waitSemaphoreInfos, gfx_stage_flags signalStage)
+  {
+    auto& ctx        = gfx2::internal::GetContextInstance();
+    const auto queue = commandBuffers.front()->queue;
+
+    thread_local auto commandBufferInfos = std::vector<VkCommandBufferSubmitInfo>();
+    commandBufferInfos.clear();
+    for (auto commandBuffer : commandBuffers)
+    {
+      assert(commandBuffer->queue == queue);
+      if (!commandBuffer->ended)
+      {
+        gfx_end_command_buffer(commandBuffer);
+      }
+      commandBufferInfos.push_back(VkCommandBufferSubmitInfo{
+        .sType         = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = commandBuffer->cmd,
+      });
+    }
+
+    gfx2::internal::RunPostedReleases(ctx);
+    gfx2::internal::FlushDescriptorWrites(ctx);
+
+    const auto signalValue = ++ctx.semaphoreValues[queue];
+    CheckVkResult(vkQueueSubmit2(ctx.queues[queue],
+      1,
+      ToPtr(VkSubmitInfo2{
+        .sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount   = static_cast<uint32_t>(waitSemaphoreInfos.size()),
+        .pWaitSemaphoreInfos      = waitSemaphoreInfos.data(),
+        .commandBufferInfoCount   = static_cast<uint32_t>(commandBufferInfos.size()),
+        .pCommandBufferInfos      = commandBufferInfos.data(),
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos    = ToPtr(VkSemaphoreSubmitInfo{
+             .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+             .semaphore = ctx.semaphores[queue].semaphore,
+             .value     = signalValue,
+             .stageMask = ToVkStageFlags(signalStage),
+        }),
+      }),
+      VK_NULL_HANDLE));
+
+    for (auto commandBuffer : commandBuffers)
+    {
+      commandBuffer->submitValue = signalValue;
+    }
+
+    gfx2::internal::CollectDeferredDestructions(ctx, false);
+
+    return {&ctx.semaphores[queue], signalValue};
+  }
+
+  // Flushes barriers, binds everything a dispatch needs and pushes size bytes of pushConstants. Binds that are already current are skipped.
+  void BindComputePipeline(gfx_command_buffer commandBuffer, gfx_compute_pipeline pipeline, const void* pushConstants, uint32_t size)
+  {
+    auto& ctx = gfx2::internal::GetContextInstance();
+
+    FlushBarriers(commandBuffer);
+
+    // Every pipeline uses the common layout, so the bindless set stays bound across pipeline changes.
+    if (!commandBuffer->descriptorSetBound)
+    {
+      vkCmdBindDescriptorSets(commandBuffer->cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ctx.commonPipelineLayout, 0, 1, &ctx.descriptorSet, 0, nullptr);
+      commandBuffer->descriptorSetBound = true;
+    }
+
+    if (commandBuffer->boundComputePipeline != pipeline->pipeline)
+    {
+      vkCmdBindPipeline(commandBuffer->cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
+      commandBuffer->boundComputePipeline = pipeline->pipeline;
+    }
+
+    vkCmdPushConstants(commandBuffer->cmd, ctx.commonPipelineLayout, VK_SHADER_STAGE_ALL, 0, size, pushConstants);
+  }
+
   VkImageAspectFlagBits ToVkAspectFlagBits(gfx_aspect_flag_bits inBit)
   {
     switch (inBit)
@@ -48,39 +226,103 @@ gfx_command_buffer gfx_create_command_buffer(gfx_queue queue)
 {
   auto& ctx = gfx2::internal::GetContextInstance();
 
-  auto* commandBuffer = new gfx_command_buffer_t();
+  auto& pools = gfx2::internal::GetThreadCommandPools(ctx);
+
+  auto* commandBuffer  = new gfx_command_buffer_t();
   commandBuffer->queue = queue;
-  CheckVkResult(vkAllocateCommandBuffers(ctx.device,
-    ToPtr(VkCommandBufferAllocateInfo{
-      .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-      .commandPool        = ctx.commandPools[queue],
-      .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-      .commandBufferCount = 1,
-    }),
-    &commandBuffer->cmd));
+  commandBuffer->pools = &pools;
+
+  {
+    auto lock      = std::lock_guard(pools.recycledMutex);
+    auto& recycled = pools.recycledCommandBuffers[queue];
+    if (!recycled.empty())
+    {
+      auto completedValue = uint64_t{};
+      CheckVkResult(vkGetSemaphoreCounterValue(ctx.device, ctx.semaphores[queue].semaphore, &completedValue));
+
+      auto it = std::ranges::find_if(recycled, [completedValue](const auto& entry) { return entry.submitValue <= completedValue; });
+      if (it != recycled.end())
+      {
+        commandBuffer->cmd = it->cmd;
+        *it                = recycled.back();
+        recycled.pop_back();
+      }
+    }
+  }
+
+  // The pool belongs to this thread, so the buffer can be reset or allocated without holding the lock.
+  if (commandBuffer->cmd)
+  {
+    CheckVkResult(vkResetCommandBuffer(commandBuffer->cmd, 0));
+  }
+  else
+  {
+    CheckVkResult(vkAllocateCommandBuffers(ctx.device,
+      ToPtr(VkCommandBufferAllocateInfo{
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool        = pools.pools[queue],
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+      }),
+      &commandBuffer->cmd));
+  }
 
   CheckVkResult(vkBeginCommandBuffer(commandBuffer->cmd,
     ToPtr(VkCommandBufferBeginInfo{
       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     })));
 
   return commandBuffer;
 }
 
+void gfx_end_command_buffer(gfx_command_buffer command_buffer)
+{
+  assert(!command_buffer->ended);
+  FlushBarriers(command_buffer);
+  CheckVkResult(vkEndCommandBuffer(command_buffer->cmd));
+  command_buffer->ended = true;
+}
+
+gfx2::internal::HazardTracker::Resource gfx2::internal::ToTrackedResource(const gfx_resource_use& use)
+{
+  assert((use.image == nullptr) != (use.device_ptr == nullptr));
+  return use.image ? ToTrackedImage(use.image) : ToTrackedRange(use.device_ptr, use.size);
+}
+
+void gfx2::internal::TrackResourceUses(gfx_command_buffer commandBuffer, std::span<const gfx_resource_use> uses, gfx_stage_flags stage)
+{
+  auto barrier = VkMemoryBarrier2{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+  for (const auto& use : uses)
+  {
+    commandBuffer->hazardTracker->Access(ToTrackedResource(use), ToVkStageFlags(stage), ToVkAccessFlags(use.access), barrier);
+  }
+  QueueTrackedBarrier(commandBuffer, barrier);
+}
+
+void gfx_enable_hazard_tracking(gfx_command_buffer command_buffer)
+{
+  assert(!command_buffer->hazardTracker);
+  command_buffer->hazardTracker.emplace();
+}
+
+// The command buffer may still be executing, so it is handed to the recycler instead of being freed.
+// It is reused by gfx_create_command_buffer once the GPU has passed the value it was submitted with.
 void gfx_destroy_command_buffer(gfx_command_buffer command_buffer)
 {
-  auto& ctx = gfx2::internal::GetContextInstance();
-  vkFreeCommandBuffers(ctx.device, ctx.commandPools[command_buffer->queue], 1, &command_buffer->cmd);
+  auto lock = std::lock_guard(command_buffer->pools->recycledMutex);
+  command_buffer->pools->recycledCommandBuffers[command_buffer->queue].push_back({
+    .cmd         = command_buffer->cmd,
+    .submitValue = command_buffer->submitValue,
+  });
   delete command_buffer;
 }
 
 gfx_submit_token gfx_submit(gfx_command_buffer command_buffer, const gfx_submit_token* wait_tokens, uint32_t num_wait_tokens)
 {
   assert(num_wait_tokens == 0 || wait_tokens != nullptr);
-  auto& ctx = gfx2::internal::GetContextInstance();
 
-  auto waitSemaphoreInfos = std::vector<VkSemaphoreSubmitInfo>();
-  waitSemaphoreInfos.reserve(num_wait_tokens);
+  auto& waitSemaphoreInfos = GetWaitSemaphoreInfos();
   for (uint32_t i = 0; i < num_wait_tokens; i++)
   {
     waitSemaphoreInfos.push_back(VkSemaphoreSubmitInfo{
@@ -91,29 +333,35 @@ gfx_submit_token gfx_submit(gfx_command_buffer command_buffer, const gfx_submit_
     });
   }
 
-  CheckVkResult(vkEndCommandBuffer(command_buffer->cmd));
-  CheckVkResult(vkQueueSubmit2(ctx.queues[command_buffer->queue],
-    1,
-    ToPtr(VkSubmitInfo2{
-      .sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-      .waitSemaphoreInfoCount   = num_wait_tokens,
-      .pWaitSemaphoreInfos      = waitSemaphoreInfos.data(),
-      .commandBufferInfoCount   = 1,
-      .pCommandBufferInfos      = ToPtr(VkCommandBufferSubmitInfo{
-             .sType         = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
-             .commandBuffer = command_buffer->cmd,
-      }),
-      .signalSemaphoreInfoCount = 1,
-      .pSignalSemaphoreInfos    = ToPtr(VkSemaphoreSubmitInfo{
-           .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-           .semaphore = ctx.semaphores[command_buffer->queue].semaphore,
-           .value     = ++ctx.semaphoreValues[command_buffer->queue],
-           .stageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-      }),
-    }),
-    VK_NULL_HANDLE));
+  return Submit({&command_buffer, 1}, waitSemaphoreInfos, GFX_STAGE_ALL);
+}
+
+gfx_submit_token gfx_submit_ex(gfx_command_buffer command_buffer, const gfx_submit_wait* waits, uint32_t num_waits, gfx_stage_flags signal_stage)
+{
+  return gfx_submit_batch(&command_buffer, 1, waits, num_waits, signal_stage);
+}
+
+gfx_submit_token gfx_submit_batch(const gfx_command_buffer* command_buffers,
+  uint32_t num_command_buffers,
+  const gfx_submit_wait* waits,
+  uint32_t num_waits,
+  gfx_stage_flags signal_stage)
+{
+  assert(num_command_buffers > 0 && command_buffers != nullptr);
+  assert(num_waits == 0 || waits != nullptr);
+
+  auto& waitSemaphoreInfos = GetWaitSemaphoreInfos();
+  for (uint32_t i = 0; i < num_waits; i++)
+  {
+    waitSemaphoreInfos.push_back(VkSemaphoreSubmitInfo{
+      .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = waits[i].token.semaphore->semaphore,
+      .value     = waits[i].token.value,
+      .stageMask = ToVkStageFlags(waits[i].stage),
+    });
+  }
 
-  return {&ctx.semaphores[command_buffer->queue], ctx.semaphoreValues[command_buffer->queue]};
+  return Submit({command_buffers, num_command_buffers}, waitSemaphoreInfos, signal_stage);
 }
 
 void gfx_wait_submit(gfx_submit_token token)
@@ -129,64 +377,184 @@ void gfx_wait_submit(gfx_submit_token token)
     UINT64_MAX);
 }
 
+int gfx_is_submit_complete(gfx_submit_token token)
+{
+  return gfx2::internal::IsSubmitComplete(gfx2::internal::GetContextInstance(), token);
+}
+
+int gfx_wait_submits(const gfx_submit_token* tokens, uint32_t num_tokens, gfx_wait_mode mode, uint64_t timeout_ns)
+{
+  assert(num_tokens == 0 || tokens != nullptr);
+  auto& ctx = gfx2::internal::GetContextInstance();
+
+  thread_local auto semaphores = std::vector<VkSemaphore>();
+  thread_local auto values     = std::vector<uint64_t>();
+  semaphores.clear();
+  values.clear();
+
+  for (uint32_t i = 0; i < num_tokens; i++)
+  {
+    // Default-initialized tokens never block.
+    if (!tokens[i].semaphore)
+    {
+      if (mode == GFX_WAIT_ANY)
+      {
+        return true;
+      }
+      continue;
+    }
+
+    semaphores.push_back(tokens[i].semaphore->semaphore);
+    values.push_back(tokens[i].value);
+  }
+
+  if (semaphores.empty())
+  {
+    return true;
+  }
+
+  const auto result = vkWaitSemaphores(ctx.device,
+    ToPtr(VkSemaphoreWaitInfo{
+      .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .flags          = mode == GFX_WAIT_ANY ? VkSemaphoreWaitFlags(VK_SEMAPHORE_WAIT_ANY_BIT) : 0,
+      .semaphoreCount = static_cast<uint32_t>(semaphores.size()),
+      .pSemaphores    = semaphores.data(),
+      .pValues        = values.data(),
+    }),
+    timeout_ns);
+
+  if (result == VK_TIMEOUT)
+  {
+    return false;
+  }
+
+  CheckVkResult(result);
+  return true;
+}
+
 void gfx_cmd_barrier(gfx_command_buffer command_buffer, gfx_stage_flags srcStage, gfx_access_flags srcAccess, gfx_stage_flags dstStage, gfx_access_flags dstAccess)
 {
-  vkCmdPipelineBarrier2(command_buffer->cmd,
-    ToPtr(VkDependencyInfo{
-      .sType              = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-      .memoryBarrierCount = 1,
-      .pMemoryBarriers    = ToPtr(VkMemoryBarrier2{
-           .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
-           .srcStageMask  = ToVkStageFlags(srcStage),
-           .srcAccessMask = ToVkAccessFlags(srcAccess),
-           .dstStageMask  = ToVkStageFlags(dstStage),
-           .dstAccessMask = ToVkAccessFlags(dstAccess),
-      }),
-    }));
+  auto barrier = VkMemoryBarrier2{
+    .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+    .srcStageMask  = ToVkStageFlags(srcStage),
+    .srcAccessMask = ToVkAccessFlags(srcAccess),
+    .dstStageMask  = ToVkStageFlags(dstStage),
+    .dstAccessMask = ToVkAccessFlags(dstAccess),
+  };
+  ChainPendingBarriers(command_buffer, barrier);
+  command_buffer->pendingMemoryBarriers.push_back(barrier);
 }
 
 void gfx_cmd_dispatch(gfx_command_buffer command_buffer, gfx_compute_pipeline pipeline, uint32_t x, uint32_t y, uint32_t z, const void* args)
 {
-  auto& ctx = gfx2::internal::GetContextInstance();
-  vkCmdBindDescriptorSets(command_buffer->cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ctx.commonPipelineLayout, 0, 1, &ctx.descriptorSet, 0, nullptr);
-  vkCmdBindPipeline(command_buffer->cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
-  vkCmdPushConstants(command_buffer->cmd, ctx.commonPipelineLayout, VK_SHADER_STAGE_ALL, 0, 8, static_cast<const void*>(&args));
+  BindComputePipeline(command_buffer, pipeline, &args, sizeof(args));
   vkCmdDispatch(command_buffer->cmd, x, y, z);
 }
 
+void gfx_cmd_dispatch_inline(gfx_command_buffer command_buffer, gfx_compute_pipeline pipeline, uint32_t x, uint32_t y, uint32_t z, const void* args, uint32_t args_size)
+{
+  assert(args);
+  assert(args_size > 0 && args_size <= GFX_MAX_INLINE_ARGS_SIZE);
+  assert(args_size % 4 == 0);
+
+  BindComputePipeline(command_buffer, pipeline, args, args_size);
+  vkCmdDispatch(command_buffer->cmd, x, y, z);
+}
+
+void gfx_cmd_dispatch_base(gfx_command_buffer command_buffer,
+  gfx_compute_pipeline pipeline,
+  uint32_t base_x,
+  uint32_t base_y,
+  uint32_t base_z,
+  uint32_t x,
+  uint32_t y,
+  uint32_t z,
+  const void* args)
+{
+  BindComputePipeline(command_buffer, pipeline, &args, sizeof(args));
+  vkCmdDispatchBase(command_buffer->cmd, base_x, base_y, base_z, x, y, z);
+}
+
+void gfx_cmd_dispatch_indirect(gfx_command_buffer command_buffer, gfx_compute_pipeline pipeline, const void* device_args_ptr, const void* args)
+{
+  auto& ctx               = gfx2::internal::GetContextInstance();
+  const auto mapping      = ctx.memoryMappings.DeviceAddressToMapping(device_args_ptr);
+  const auto bufferOffset = mapping.bufferOffset + (reinterpret_cast<VkDeviceAddress>(device_args_ptr) - mapping.deviceAddress);
+  assert(bufferOffset % 4 == 0);
+
+  if (command_buffer->hazardTracker)
+  {
+    auto barrier = VkMemoryBarrier2{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    command_buffer->hazardTracker->Access(ToTrackedRange(device_args_ptr, 3 * sizeof(uint32_t)),
+      VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+      barrier);
+    QueueTrackedBarrier(command_buffer, barrier);
+  }
+
+  BindComputePipeline(command_buffer, pipeline, &args, sizeof(args));
+  vkCmdDispatchIndirect(command_buffer->cmd, mapping.buffer, bufferOffset);
+}
+
 void gfx_cmd_init_discard_image(gfx_command_buffer command_buffer, gfx_image image)
 {
-  vkCmdPipelineBarrier2(command_buffer->cmd,
-    ToPtr(VkDependencyInfo{
-      .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-      .imageMemoryBarrierCount = 1,
-      .pImageMemoryBarriers    = ToPtr(VkImageMemoryBarrier2{
-           .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-           // This is unsatisfying, but some arbitrary stage must be chosen to make barriers that sync the transition reasonable.
-           .srcStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
-           .srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
-           .dstStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
-           .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
-           .oldLayout     = VK_IMAGE_LAYOUT_UNDEFINED,
-           .newLayout     = VK_IMAGE_LAYOUT_GENERAL,
-           .image         = image->internalImage->image,
-           .subresourceRange =
-          VkImageSubresourceRange{
-               .aspectMask     = gfx2::internal::FormatToAspectFlags(gfx2::internal::VkToFormat(image->internalImage->createInfo.format)),
-               .baseMipLevel   = 0,
-               .levelCount     = VK_REMAINING_MIP_LEVELS,
-               .baseArrayLayer = 0,
-               .layerCount     = VK_REMAINING_ARRAY_LAYERS,
-          },
-      }),
-    }));
+  // The transition counts as a write. Its barrier is queued after the tracked one, so it chains onto earlier accesses.
+  if (command_buffer->hazardTracker)
+  {
+    auto trackedBarrier = VkMemoryBarrier2{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    command_buffer->hazardTracker->Access(ToTrackedImage(image), VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT, trackedBarrier);
+    QueueTrackedBarrier(command_buffer, trackedBarrier);
+  }
+
+  auto barrier = VkImageMemoryBarrier2{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+    // This is unsatisfying, but some arbitrary stage must be chosen to make barriers that sync the transition reasonable.
+    .srcStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+    .srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+    .dstStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+    .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+    .oldLayout     = VK_IMAGE_LAYOUT_UNDEFINED,
+    .newLayout     = VK_IMAGE_LAYOUT_GENERAL,
+    .image         = image->internalImage->image,
+    .subresourceRange =
+      VkImageSubresourceRange{
+        .aspectMask     = gfx2::internal::FormatToAspectFlags(gfx2::internal::VkToFormat(image->internalImage->createInfo.format)),
+        .baseMipLevel   = 0,
+        .levelCount     = VK_REMAINING_MIP_LEVELS,
+        .baseArrayLayer = 0,
+        .layerCount     = VK_REMAINING_ARRAY_LAYERS,
+      },
+  };
+  ChainPendingBarriers(command_buffer, barrier);
+  command_buffer->pendingImageBarriers.push_back(barrier);
+}
+
+void gfx_cmd_use_resources(gfx_command_buffer command_buffer, const gfx_resource_use* uses, uint32_t num_uses)
+{
+  assert(num_uses == 0 || uses);
+
+  if (command_buffer->hazardTracker)
+  {
+    gfx2::internal::TrackResourceUses(command_buffer, {uses, num_uses}, GFX_STAGE_COMPUTE);
+  }
 }
 
 void gfx_cmd_copy_buffer_to_image(gfx_command_buffer command_buffer, const gfx_copy_buffer_image_info* info)
 {
   auto& ctx               = gfx2::internal::GetContextInstance();
   const auto mapping      = ctx.memoryMappings.DeviceAddressToMapping(info->buffer);
-  const auto bufferOffset = reinterpret_cast<VkDeviceAddress>(info->buffer) - mapping.deviceAddress;
+  const auto bufferOffset = mapping.bufferOffset + (reinterpret_cast<VkDeviceAddress>(info->buffer) - mapping.deviceAddress);
+
+  // The buffer side is tracked up to the end of its allocation rather than the exact footprint of the copy.
+  if (command_buffer->hazardTracker)
+  {
+    auto barrier = VkMemoryBarrier2{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    command_buffer->hazardTracker->Access(ToTrackedRange(info->buffer, 0), VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, barrier);
+    command_buffer->hazardTracker->Access(ToTrackedImage(info->image), VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, barrier);
+    QueueTrackedBarrier(command_buffer, barrier);
+  }
+
+  FlushBarriers(command_buffer);
   // clang-format off
   vkCmdCopyBufferToImage2(command_buffer->cmd,
     ToPtr(VkCopyBufferToImageInfo2{
@@ -217,7 +585,18 @@ void gfx_cmd_copy_image_to_buffer(gfx_command_buffer command_buffer, const gfx_c
 {
   auto& ctx               = gfx2::internal::GetContextInstance();
   const auto mapping      = ctx.memoryMappings.DeviceAddressToMapping(info->buffer);
-  const auto bufferOffset = reinterpret_cast<VkDeviceAddress>(info->buffer) - mapping.deviceAddress;
+  const auto bufferOffset = mapping.bufferOffset + (reinterpret_cast<VkDeviceAddress>(info->buffer) - mapping.deviceAddress);
+
+  // The buffer side is tracked up to the end of its allocation rather than the exact footprint of the copy.
+  if (command_buffer->hazardTracker)
+  {
+    auto barrier = VkMemoryBarrier2{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    command_buffer->hazardTracker->Access(ToTrackedRange(info->buffer, 0), VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, barrier);
+    command_buffer->hazardTracker->Access(ToTrackedImage(info->image), VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, barrier);
+    QueueTrackedBarrier(command_buffer, barrier);
+  }
+
+  FlushBarriers(command_buffer);
   // clang-format off
   vkCmdCopyImageToBuffer2(command_buffer->cmd,
     ToPtr(VkCopyImageToBufferInfo2{
@@ -0,0 +1,171 @@
+#include "gfx2.h"
+#include "detail/common.hpp"
+#include "detail/context.hpp"
+
+#include <array>
+#include <cassert>
+#include <mutex>
+#include <vector>
+
+using namespace gfx2::internal;
+
+namespace
+{
+  thread_local bool sIsCompletionThread = false;
+
+  void CompletionThreadMain(Context& ctx)
+  {
+    sIsCompletionThread = true;
+
+    auto& completion = ctx.completionThread;
+    auto lock        = std::unique_lock(completion.mutex);
+    auto ready       = std::vector<CompletionCallback>();
+
+    while (true)
+    {
+      auto semaphores = std::array<VkSemaphore, GFX_NUM_QUEUES + 1>();
+      auto values     = std::array<uint64_t, GFX_NUM_QUEUES + 1>();
+      auto count      = uint32_t{};
+
+      // Wait for the earliest callback on each queue.
+      for (uint32_t queue = 0; queue < GFX_NUM_QUEUES; queue++)
+      {
+        if (!completion.callbacks[queue].empty())
+        {
+          semaphores[count] = ctx.semaphores[queue].semaphore;
+          values[count]     = completion.callbacks[queue].begin()->first;
+          count++;
+        }
+      }
+
+      if (completion.stopRequested && count == 0)
+      {
+        break;
+      }
+
+      // Once stopping, nothing new can be added, so only the GPU can make progress.
+      if (!completion.stopRequested)
+      {
+        semaphores[count] = completion.wakeSemaphore;
+        values[count]     = completion.wakeValue + 1;
+        count++;
+      }
+
+      lock.unlock();
+      CheckVkResult(vkWaitSemaphores(ctx.device,
+        ToPtr(VkSemaphoreWaitInfo{
+          .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+          .flags          = VK_SEMAPHORE_WAIT_ANY_BIT,
+          .semaphoreCount = count,
+          .pSemaphores    = semaphores.data(),
+          .pValues        = values.data(),
+        }),
+        UINT64_MAX));
+      lock.lock();
+
+      for (uint32_t queue = 0; queue < GFX_NUM_QUEUES; queue++)
+      {
+        auto& callbacks = completion.callbacks[queue];
+        if (callbacks.empty())
+        {
+          continue;
+        }
+
+        auto completedValue = uint64_t{};
+        CheckVkResult(vkGetSemaphoreCounterValue(ctx.device, ctx.semaphores[queue].semaphore, &completedValue));
+
+        const auto end = callbacks.upper_bound(completedValue);
+        for (auto it = callbacks.begin(); it != end; ++it)
+        {
+          ready.push_back(it->second);
+        }
+        callbacks.erase(callbacks.begin(), end);
+      }
+
+      // Callbacks may call back into the library, so they run without the lock held.
+      lock.unlock();
+      for (const auto& [callback, userData] : ready)
+      {
+        callback(userData);
+      }
+      ready.clear();
+      lock.lock();
+    }
+  }
+
+  // Must be called with the completion mutex held.
+  void WakeCompletionThread(Context& ctx)
+  {
+    auto& completion = ctx.completionThread;
+    CheckVkResult(vkSignalSemaphore(ctx.device,
+      ToPtr(VkSemaphoreSignalInfo{
+        .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO,
+        .semaphore = completion.wakeSemaphore,
+        .value     = ++completion.wakeValue,
+      })));
+  }
+} // namespace
+
+bool gfx2::internal::IsCompletionThread()
+{
+  return sIsCompletionThread;
+}
+
+void gfx2::internal::StopCompletionThread(Context& ctx)
+{
+  auto& completion = ctx.completionThread;
+
+  {
+    auto lock = std::lock_guard(completion.mutex);
+    if (!completion.thread.joinable())
+    {
+      return;
+    }
+
+    completion.stopRequested = true;
+    WakeCompletionThread(ctx);
+  }
+
+  completion.thread.join();
+  vkDestroySemaphore(ctx.device, completion.wakeSemaphore, nullptr);
+}
+
+void gfx_on_submit_complete(gfx_submit_token token, gfx_submit_callback callback, void* user_data)
+{
+  assert(callback);
+  auto& ctx = GetContextInstance();
+
+  if (!token.semaphore)
+  {
+    callback(user_data);
+    return;
+  }
+
+  const auto queue = static_cast<uint32_t>(token.semaphore - ctx.semaphores);
+  assert(queue < GFX_NUM_QUEUES);
+
+  auto& completion = ctx.completionThread;
+  auto lock        = std::lock_guard(completion.mutex);
+  assert(!completion.stopRequested);
+
+  if (!completion.thread.joinable())
+  {
+    CheckVkResult(vkCreateSemaphore(ctx.device,
+      ToPtr(VkSemaphoreCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = ToPtr(VkSemaphoreTypeCreateInfo{
+          .sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+          .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+          .initialValue  = 0,
+        }),
+      }),
+      nullptr,
+      &completion.wakeSemaphore));
+
+    completion.wakeValue = 0;
+    completion.thread    = std::thread(CompletionThreadMain, std::ref(ctx));
+  }
+
+  completion.callbacks[queue].emplace(token.value, CompletionCallback{callback, user_data});
+  WakeCompletionThread(ctx);
+}
\ No newline at end of file
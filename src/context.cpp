@@ -1,9 +1,10 @@
 #include "detail/context.hpp"
 #include "detail/common.hpp"
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
-#include <ranges>
 
 namespace
 {
@@ -121,62 +122,224 @@ namespace
         .pPushConstantRanges    = ToPtr(VkPushConstantRange{
              .stageFlags = VK_SHADER_STAGE_ALL,
              .offset     = 0,
-             .size       = 8,
+             .size       = GFX_MAX_INLINE_ARGS_SIZE,
         }),
       }),
       nullptr,
       &ctx.commonPipelineLayout));
   }
+}
+
+gfx2::internal::IndexAllocator::IndexAllocator(uint32_t numIndices)
+  : numIndices_(numIndices)
+{
+}
 
-  void CreateCommandPools(gfx2::internal::Context& ctx)
+uint32_t gfx2::internal::IndexAllocator::Allocate()
+{
+  // Reuse the lowest free index so descriptor indices stay dense. The top level has one word per 2^18 indices, so this loop is short.
+  for (size_t i = 0; i < nonEmptySummaries_.size(); i++)
   {
-    CheckVkResult(vkCreateCommandPool(ctx.device,
-      ToPtr(VkCommandPoolCreateInfo{
-        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = ctx.graphicsQueueFamilyIndex,
-      }),
-      nullptr,
-      &ctx.commandPools[GFX_QUEUE_GRAPHICS]));
+    if (auto& top = nonEmptySummaries_[i]; top != 0)
+    {
+      const auto summaryIndex = i * 64 + std::countr_zero(top);
+      auto& summary           = nonEmptyWords_[summaryIndex];
+      const auto wordIndex    = summaryIndex * 64 + std::countr_zero(summary);
+      auto& word              = freeBits_[wordIndex];
+      const auto bit          = std::countr_zero(word);
 
-    CheckVkResult(vkCreateCommandPool(ctx.device,
-      ToPtr(VkCommandPoolCreateInfo{
-        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = ctx.computeQueueFamilyIndex,
-      }),
-      nullptr,
-      &ctx.commandPools[GFX_QUEUE_COMPUTE]));
+      word &= word - 1;
+      if (word == 0)
+      {
+        summary &= summary - 1;
+        if (summary == 0)
+        {
+          top &= top - 1;
+        }
+      }
+
+      return static_cast<uint32_t>(wordIndex * 64 + bit);
+    }
+  }
+
+  assert(highWater_ < numIndices_);
+  const auto index = highWater_++;
+  if (index % 64 == 0)
+  {
+    if (freeBits_.size() % 64 == 0)
+    {
+      if (nonEmptyWords_.size() % 64 == 0)
+      {
+        nonEmptySummaries_.push_back(0);
+      }
+      nonEmptyWords_.push_back(0);
+    }
+    freeBits_.push_back(0);
+  }
+
+  return index;
+}
+
+void gfx2::internal::IndexAllocator::Free(uint32_t index)
+{
+  assert(index < highWater_);
+  const auto wordIndex    = index / 64;
+  const auto summaryIndex = wordIndex / 64;
+  assert((freeBits_[wordIndex] & (uint64_t(1) << (index % 64))) == 0);
+
+  freeBits_[wordIndex] |= uint64_t(1) << (index % 64);
+  nonEmptyWords_[summaryIndex] |= uint64_t(1) << (wordIndex % 64);
+  nonEmptySummaries_[summaryIndex / 64] |= uint64_t(1) << (summaryIndex % 64);
+}
+
+gfx2::internal::CommandPools& gfx2::internal::GetThreadCommandPools(Context& ctx)
+{
+  auto lock   = std::lock_guard(ctx.commandPoolsMutex);
+  auto& pools = ctx.commandPools[std::this_thread::get_id()];
+
+  if (!pools)
+  {
+    pools = std::make_unique<CommandPools>();
+
+    const auto queueFamilyIndices = std::array{ctx.graphicsQueueFamilyIndex, ctx.computeQueueFamilyIndex, ctx.transferQueueFamilyIndex};
+    for (uint32_t queue = 0; queue < GFX_NUM_QUEUES; queue++)
+    {
+      CheckVkResult(vkCreateCommandPool(ctx.device,
+        ToPtr(VkCommandPoolCreateInfo{
+          .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+          .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+          .queueFamilyIndex = queueFamilyIndices[queue],
+        }),
+        nullptr,
+        &pools->pools[queue]));
+    }
+  }
+
+  return *pools;
+}
+
+void gfx2::internal::FlushDescriptorWrites(Context& ctx)
+{
+  if (ctx.pendingDescriptorWrites.empty())
+  {
+    return;
+  }
+
+  auto writes = std::vector<VkWriteDescriptorSet>();
+  writes.reserve(ctx.pendingDescriptorWrites.size());
+  for (const auto& pending : ctx.pendingDescriptorWrites)
+  {
+    writes.push_back(VkWriteDescriptorSet{
+      .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet          = ctx.descriptorSet,
+      .dstBinding      = pending.binding,
+      .dstArrayElement = pending.index,
+      .descriptorCount = 1,
+      .descriptorType  = pending.type,
+      .pImageInfo      = &pending.imageInfo,
+    });
+  }
+
+  vkUpdateDescriptorSets(ctx.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+  ctx.pendingDescriptorWrites.clear();
+}
 
-    CheckVkResult(vkCreateCommandPool(ctx.device,
-      ToPtr(VkCommandPoolCreateInfo{
-        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = ctx.transferQueueFamilyIndex,
+void gfx2::internal::DeferDestruction(Context& ctx, std::function<void()> destroy)
+{
+  if (!ctx.deferDestruction)
+  {
+    destroy();
+    return;
+  }
+
+  auto& deferred = ctx.deferredDestructions.emplace_back();
+  std::ranges::copy(ctx.semaphoreValues, deferred.semaphoreValues);
+  deferred.destroy = std::move(destroy);
+
+  CollectDeferredDestructions(ctx, false);
+}
+
+void gfx2::internal::CollectDeferredDestructions(Context& ctx, bool wait)
+{
+  if (ctx.deferredDestructions.empty())
+  {
+    return;
+  }
+
+  if (wait)
+  {
+    auto semaphores = std::array<VkSemaphore, GFX_NUM_QUEUES>();
+    std::ranges::transform(ctx.semaphores, semaphores.begin(), [](const auto& semaphore) { return semaphore.semaphore; });
+    CheckVkResult(vkWaitSemaphores(ctx.device,
+      ToPtr(VkSemaphoreWaitInfo{
+        .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = GFX_NUM_QUEUES,
+        .pSemaphores    = semaphores.data(),
+        .pValues        = ctx.semaphoreValues,
       }),
-      nullptr,
-      &ctx.commandPools[GFX_QUEUE_TRANSFER]));
+      UINT64_MAX));
+  }
+
+  auto completedValues = std::array<uint64_t, GFX_NUM_QUEUES>();
+  for (uint32_t queue = 0; queue < GFX_NUM_QUEUES; queue++)
+  {
+    CheckVkResult(vkGetSemaphoreCounterValue(ctx.device, ctx.semaphores[queue].semaphore, &completedValues[queue]));
+  }
+
+  while (!ctx.deferredDestructions.empty())
+  {
+    auto& front = ctx.deferredDestructions.front();
+    for (uint32_t queue = 0; queue < GFX_NUM_QUEUES; queue++)
+    {
+      if (front.semaphoreValues[queue] > completedValues[queue])
+      {
+        return;
+      }
+    }
+
+    // Move out first, as destroying may queue more work.
+    auto destroy = std::move(front.destroy);
+    ctx.deferredDestructions.pop_front();
+    destroy();
   }
 }
 
-gfx2::internal::IndexAllocator::IndexAllocator(uint32_t numIndices)
+bool gfx2::internal::PostFromCompletionThread(Context& ctx, std::function<void()> release)
 {
-  for (auto i : std::ranges::reverse_view(std::views::iota(uint32_t(0), numIndices)))
+  if (!IsCompletionThread())
   {
-    freeSlots_.push(i);
+    return false;
   }
+
+  auto lock = std::lock_guard(ctx.postedReleasesMutex);
+  ctx.postedReleases.push_back(std::move(release));
+  return true;
 }
 
-uint32_t gfx2::internal::IndexAllocator::Allocate()
+void gfx2::internal::RunPostedReleases(Context& ctx)
 {
-  const auto index = freeSlots_.top();
-  freeSlots_.pop();
-  return index;
+  auto releases = std::vector<std::function<void()>>();
+  {
+    auto lock = std::lock_guard(ctx.postedReleasesMutex);
+    releases.swap(ctx.postedReleases);
+  }
+
+  for (const auto& release : releases)
+  {
+    release();
+  }
 }
 
-void gfx2::internal::IndexAllocator::Free(uint32_t index)
+bool gfx2::internal::IsSubmitComplete(const Context& ctx, gfx_submit_token token)
 {
-  freeSlots_.push(index);
+  if (!token.semaphore)
+  {
+    return true;
+  }
+
+  auto value = uint64_t{};
+  CheckVkResult(vkGetSemaphoreCounterValue(ctx.device, token.semaphore->semaphore, &value));
+  return value >= token.value;
 }
 
 void gfx2::internal::CreateContextInstance(const gfx_vulkan_init_info& info)
@@ -192,6 +355,20 @@ void gfx2::internal::CreateContextInstance(const gfx_vulkan_init_info& info)
   sContext->graphicsQueueFamilyIndex = info.graphicsQueueFamilyIndex;
   sContext->computeQueueFamilyIndex  = info.computeQueueFamilyIndex;
   sContext->transferQueueFamilyIndex = info.transferQueueFamilyIndex;
+  sContext->deferDestruction         = info.deferDestruction != 0;
+
+  // Devices with a single queue family, such as software drivers, may use one family for every queue.
+  // Concurrent sharing requires distinct indices and more than one of them.
+  sContext->numUniqueQueueFamilies = 0;
+  for (auto index : {info.graphicsQueueFamilyIndex, info.computeQueueFamilyIndex, info.transferQueueFamilyIndex})
+  {
+    const auto unique = std::span(sContext->uniqueQueueFamilyIndices, sContext->numUniqueQueueFamilies);
+    if (std::ranges::find(unique, index) == unique.end())
+    {
+      sContext->uniqueQueueFamilyIndices[sContext->numUniqueQueueFamilies++] = index;
+    }
+  }
+  sContext->sharingMode = sContext->numUniqueQueueFamilies > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
   
   vkGetDeviceQueue(sContext->device, info.graphicsQueueFamilyIndex, 0, &sContext->queues[GFX_QUEUE_GRAPHICS]);
   vkGetDeviceQueue(sContext->device, info.computeQueueFamilyIndex, 0, &sContext->queues[GFX_QUEUE_COMPUTE]);
@@ -219,20 +396,44 @@ void gfx2::internal::CreateContextInstance(const gfx_vulkan_init_info& info)
 
   CreateVmaAllocator(*sContext);
   CreateDescriptorSet(*sContext);
-  CreateCommandPools(*sContext);
+
+  CheckVkResult(vkCreatePipelineCache(sContext->device,
+    ToPtr(VkPipelineCacheCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    }),
+    nullptr,
+    &sContext->pipelineCache));
 }
 
 void gfx2::internal::DestroyContextInstance()
 {
   assert(sContext);
 
+  StopCompletionThread(*sContext);
+  RunPostedReleases(*sContext);
+  CollectDeferredDestructions(*sContext, true);
+
+  vkDestroyPipelineCache(sContext->device, sContext->pipelineCache, nullptr);
   vkDestroyPipelineLayout(sContext->device, sContext->commonPipelineLayout, nullptr);
   vkDestroyDescriptorSetLayout(sContext->device, sContext->commonDescriptorSetLayout, nullptr);
   vkDestroyDescriptorPool(sContext->device, sContext->descriptorPool, nullptr);
 
-  vkDestroyCommandPool(sContext->device, sContext->commandPools[GFX_QUEUE_TRANSFER], nullptr);
-  vkDestroyCommandPool(sContext->device, sContext->commandPools[GFX_QUEUE_COMPUTE], nullptr);
-  vkDestroyCommandPool(sContext->device, sContext->commandPools[GFX_QUEUE_GRAPHICS], nullptr);
+  for (const auto& [threadId, pools] : sContext->commandPools)
+  {
+    for (auto pool : pools->pools)
+    {
+      vkDestroyCommandPool(sContext->device, pool, nullptr);
+    }
+  }
+
+  for (const auto& blocks : sContext->memoryBlocks)
+  {
+    for (const auto& block : blocks)
+    {
+      vmaDestroyVirtualBlock(block.virtualBlock);
+      vmaDestroyBuffer(sContext->allocator, block.buffer, block.allocation);
+    }
+  }
 
   vmaDestroyAllocator(sContext->allocator);
 
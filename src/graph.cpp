@@ -0,0 +1,253 @@
+#include "gfx2.h"
+#include "detail/common.hpp"
+#include "detail/context.hpp"
+
+#include <array>
+#include <cassert>
+#include <optional>
+#include <vector>
+
+using namespace gfx2::internal;
+
+namespace
+{
+  constexpr gfx_access_flags WRITE_ACCESS = GFX_ACCESS_WRITE | GFX_ACCESS_SHADER_STORAGE_WRITE | GFX_ACCESS_TRANSFER_WRITE | GFX_ACCESS_HOST_WRITE;
+
+  struct Pass
+  {
+    gfx_queue queue;
+    std::vector<gfx_resource_use> uses;
+    gfx_pass_callback record;
+    void* userData;
+    bool hasSideEffects;
+  };
+
+  // Consecutive passes on one queue, recorded into one command buffer and submitted together.
+  struct Batch
+  {
+    gfx_queue queue;
+    gfx_command_buffer commandBuffer;
+    std::vector<gfx_submit_wait> waits;
+    std::optional<gfx_submit_token> token; // Set once submitted.
+  };
+
+  // Passes do not say which commands they record, so they are assumed to use every stage their queue is given work for.
+  gfx_stage_flags PassStages(gfx_queue queue)
+  {
+    return queue == GFX_QUEUE_TRANSFER ? GFX_STAGE_TRANSFER : GFX_STAGE_COMPUTE | GFX_STAGE_TRANSFER | GFX_STAGE_DRAW_INDIRECT;
+  }
+
+  struct PassDependencies
+  {
+    std::vector<uint32_t> hazards;   // Earlier passes that must execute first (read-after-write, write-after-read and write-after-write).
+    std::vector<uint32_t> producers; // The subset that wrote something this pass accesses, which keeps them from being culled.
+  };
+
+  std::vector<PassDependencies> FindDependencies(const std::vector<Pass>& passes)
+  {
+    auto resources = std::vector<std::vector<HazardTracker::Resource>>(passes.size());
+    for (size_t i = 0; i < passes.size(); i++)
+    {
+      for (const auto& use : passes[i].uses)
+      {
+        resources[i].push_back(ToTrackedResource(use));
+      }
+    }
+
+    auto dependencies = std::vector<PassDependencies>(passes.size());
+    for (uint32_t i = 0; i < passes.size(); i++)
+    {
+      for (uint32_t j = 0; j < i; j++)
+      {
+        auto hazard   = false;
+        auto producer = false;
+        for (size_t a = 0; a < passes[i].uses.size(); a++)
+        {
+          for (size_t b = 0; b < passes[j].uses.size(); b++)
+          {
+            if (!HazardTracker::Overlaps(resources[i][a], resources[j][b]))
+            {
+              continue;
+            }
+
+            const auto laterWrites   = (passes[i].uses[a].access & WRITE_ACCESS) != 0;
+            const auto earlierWrites = (passes[j].uses[b].access & WRITE_ACCESS) != 0;
+            hazard                   = hazard || laterWrites || earlierWrites;
+            producer                 = producer || earlierWrites;
+          }
+        }
+
+        if (hazard)
+        {
+          dependencies[i].hazards.push_back(j);
+        }
+        if (producer)
+        {
+          dependencies[i].producers.push_back(j);
+        }
+      }
+    }
+
+    return dependencies;
+  }
+} // namespace
+
+struct gfx_graph_t
+{
+  std::vector<Pass> passes;
+};
+
+gfx_graph gfx_create_graph()
+{
+  return new gfx_graph_t{};
+}
+
+void gfx_destroy_graph(gfx_graph graph)
+{
+  delete graph;
+}
+
+void gfx_graph_add_pass(gfx_graph graph, const gfx_pass_info* info)
+{
+  assert(info->record);
+  assert(info->num_uses == 0 || info->uses);
+
+  graph->passes.push_back(Pass{
+    .queue          = info->queue,
+    .uses           = {info->uses, info->uses + info->num_uses},
+    .record         = info->record,
+    .userData       = info->user_data,
+    .hasSideEffects = info->has_side_effects != 0,
+  });
+}
+
+void gfx_execute_graph(gfx_graph graph, const gfx_submit_wait* waits, uint32_t num_waits, gfx_submit_token* tokens)
+{
+  assert(num_waits == 0 || waits);
+  assert(tokens);
+  auto& ctx = GetContextInstance();
+
+  const auto& passes      = graph->passes;
+  const auto dependencies = FindDependencies(passes);
+
+  // Producers always come first, so one backward sweep finds every pass that feeds a pass with side effects.
+  auto kept = std::vector<bool>(passes.size());
+  for (size_t i = passes.size(); i-- > 0;)
+  {
+    kept[i] = kept[i] || passes[i].hasSideEffects;
+    if (kept[i])
+    {
+      for (auto j : dependencies[i].producers)
+      {
+        kept[j] = true;
+      }
+    }
+  }
+
+  auto batches         = std::vector<Batch>();
+  auto openBatches     = std::array<std::optional<size_t>, GFX_NUM_QUEUES>{};
+  auto queueHasBatch   = std::array<bool, GFX_NUM_QUEUES>{};
+  auto lastQueueTokens = std::array<std::optional<gfx_submit_token>, GFX_NUM_QUEUES>{};
+  auto passBatches     = std::vector<size_t>(passes.size());
+
+  const auto submitBatch = [&](size_t index)
+  {
+    auto& batch = batches[index];
+    batch.token = gfx_submit_ex(batch.commandBuffer, batch.waits.data(), static_cast<uint32_t>(batch.waits.size()), GFX_STAGE_ALL);
+    gfx_destroy_command_buffer(batch.commandBuffer);
+    openBatches[batch.queue].reset();
+    lastQueueTokens[batch.queue] = batch.token;
+  };
+
+  for (size_t i = 0; i < passes.size(); i++)
+  {
+    if (!kept[i])
+    {
+      continue;
+    }
+    const auto queue = passes[i].queue;
+
+    // Waits apply from the start of a submission, so a pass that depends on another submission starts a new one.
+    auto needsWait = false;
+    for (auto j : dependencies[i].hazards)
+    {
+      needsWait = needsWait || (kept[j] && passBatches[j] != openBatches[queue]);
+    }
+
+    auto passWaits = std::array<std::optional<gfx_submit_token>, GFX_NUM_QUEUES>{};
+    if (needsWait)
+    {
+      if (openBatches[queue])
+      {
+        submitBatch(*openBatches[queue]);
+      }
+
+      // Tokens of one queue complete in order, so only the latest one per queue is waited on.
+      for (auto j : dependencies[i].hazards)
+      {
+        if (!kept[j])
+        {
+          continue;
+        }
+
+        auto& batch = batches[passBatches[j]];
+        if (!batch.token)
+        {
+          submitBatch(passBatches[j]);
+        }
+
+        auto& wait = passWaits[batch.queue];
+        if (!wait || wait->value < batch.token->value)
+        {
+          wait = batch.token;
+        }
+      }
+    }
+
+    if (!openBatches[queue])
+    {
+      auto batch = Batch{
+        .queue         = queue,
+        .commandBuffer = gfx_create_command_buffer(queue),
+        .waits         = {},
+        .token         = std::nullopt,
+      };
+      gfx_enable_hazard_tracking(batch.commandBuffer);
+
+      for (const auto& wait : passWaits)
+      {
+        if (wait)
+        {
+          batch.waits.push_back({.token = *wait, .stage = PassStages(queue)});
+        }
+      }
+      if (!queueHasBatch[queue])
+      {
+        batch.waits.insert(batch.waits.end(), waits, waits + num_waits);
+        queueHasBatch[queue] = true;
+      }
+
+      openBatches[queue] = batches.size();
+      batches.push_back(std::move(batch));
+    }
+
+    auto& batch    = batches[*openBatches[queue]];
+    passBatches[i] = *openBatches[queue];
+    TrackResourceUses(batch.commandBuffer, passes[i].uses, PassStages(queue));
+    passes[i].record(batch.commandBuffer, passes[i].userData);
+  }
+
+  for (auto& openBatch : openBatches)
+  {
+    if (openBatch)
+    {
+      submitBatch(*openBatch);
+    }
+  }
+
+  // A queue without work reports its last submission so that every token can be waited on.
+  for (uint32_t queue = 0; queue < GFX_NUM_QUEUES; queue++)
+  {
+    tokens[queue] = lastQueueTokens[queue].value_or(gfx_submit_token{&ctx.semaphores[queue], ctx.semaphoreValues[queue]});
+  }
+}
\ No newline at end of file
@@ -3,8 +3,6 @@
 #include "detail/common.hpp"
 #include "detail/context.hpp"
 
-#include <array>
-
 using namespace gfx2::internal;
 
 namespace
@@ -82,24 +80,18 @@ namespace
     }
   }
 
+  // Descriptor writes are queued and flushed together at the next gfx_submit or gfx_flush_descriptor_writes.
   uint32_t AllocateStorageImageDescriptor(VkImageView imageView)
   {
-    auto& ctx = GetContextInstance();
+    auto& ctx        = GetContextInstance();
     const auto index = ctx.storageImageDescriptorAllocator.Allocate();
 
-    vkUpdateDescriptorSets(ctx.device,
-      1,
-      ToPtr(VkWriteDescriptorSet{
-        .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet          = ctx.descriptorSet,
-        .dstBinding      = Context::STORAGE_IMAGE_BINDING,
-        .dstArrayElement = index,
-        .descriptorCount = 1,
-        .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        .pImageInfo      = ToPtr(VkDescriptorImageInfo{.imageView = imageView, .imageLayout = VK_IMAGE_LAYOUT_GENERAL}),
-      }),
-      0,
-      nullptr);
+    ctx.pendingDescriptorWrites.push_back({
+      .binding   = Context::STORAGE_IMAGE_BINDING,
+      .index     = index,
+      .type      = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .imageInfo = {.imageView = imageView, .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+    });
 
     return index;
   }
@@ -109,19 +101,12 @@ namespace
     auto& ctx        = GetContextInstance();
     const auto index = ctx.sampledImageDescriptorAllocator.Allocate();
 
-    vkUpdateDescriptorSets(ctx.device,
-      1,
-      ToPtr(VkWriteDescriptorSet{
-        .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet          = ctx.descriptorSet,
-        .dstBinding      = Context::SAMPLED_IMAGE_BINDING,
-        .dstArrayElement = index,
-        .descriptorCount = 1,
-        .descriptorType  = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-        .pImageInfo      = ToPtr(VkDescriptorImageInfo{.imageView = imageView, .imageLayout = VK_IMAGE_LAYOUT_GENERAL}),
-      }),
-      0,
-      nullptr);
+    ctx.pendingDescriptorWrites.push_back({
+      .binding   = Context::SAMPLED_IMAGE_BINDING,
+      .index     = index,
+      .type      = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+      .imageInfo = {.imageView = imageView, .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+    });
 
     return index;
   }
@@ -303,8 +288,6 @@ gfx_image gfx_create_image(const gfx_image_create_info* create_info)
   const uint32_t storageUsage = (FormatIsColor(create_info->format) && !FormatIsSrgb(create_info->format)) ? VK_IMAGE_USAGE_STORAGE_BIT : 0;
   uint32_t usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | storageUsage | colorOrDepthStencilUsage;
 
-  const auto queueFamilyIndices = std::array{ctx.graphicsQueueFamilyIndex, ctx.computeQueueFamilyIndex, ctx.transferQueueFamilyIndex};
-
   auto internalImage = std::shared_ptr<gfx2::internal::Image>(new gfx2::internal::Image(),
     [allocator = ctx.allocator](gfx2::internal::Image* img)
     {
@@ -323,9 +306,9 @@ gfx_image gfx_create_image(const gfx_image_create_info* create_info)
     .samples               = VK_SAMPLE_COUNT_1_BIT,
     .tiling                = VK_IMAGE_TILING_OPTIMAL,
     .usage                 = usage,
-    .sharingMode           = VK_SHARING_MODE_CONCURRENT,
-    .queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size()),
-    .pQueueFamilyIndices   = queueFamilyIndices.data(),
+    .sharingMode           = ctx.sharingMode,
+    .queueFamilyIndexCount = ctx.numUniqueQueueFamilies,
+    .pQueueFamilyIndices   = ctx.uniqueQueueFamilyIndices,
     .initialLayout         = VK_IMAGE_LAYOUT_UNDEFINED,
   };
   CheckVkResult(vmaCreateImage(ctx.allocator,
@@ -404,22 +387,45 @@ gfx_image gfx_create_image_view(const gfx_image_view_create_info* create_info)
   return image;
 }
 
-void gfx_destroy_image(gfx_image image)
+void gfx_create_images(const gfx_image_create_info* create_infos, uint32_t count, gfx_image* images)
 {
-  auto& ctx = gfx2::internal::GetContextInstance();
-  vkDestroyImageView(ctx.device, image->imageView, nullptr);
+  assert(count == 0 || (create_infos && images));
 
-  if (image->sampledDescriptor)
+  for (uint32_t i = 0; i < count; i++)
   {
-    ctx.sampledImageDescriptorAllocator.Free(image->sampledDescriptor->index);
+    images[i] = gfx_create_image(&create_infos[i]);
   }
 
-  if (image->storageDescriptor)
+  gfx2::internal::FlushDescriptorWrites(gfx2::internal::GetContextInstance());
+}
+
+void gfx_destroy_image(gfx_image image)
+{
+  auto& ctx = gfx2::internal::GetContextInstance();
+  if (gfx2::internal::PostFromCompletionThread(ctx, [image] { gfx_destroy_image(image); }))
   {
-    ctx.storageImageDescriptorAllocator.Free(image->storageDescriptor->index);
+    return;
   }
 
-  delete image;
+  gfx2::internal::DeferDestruction(ctx,
+    [&ctx, image]
+    {
+      // Queued writes may reference this view.
+      gfx2::internal::FlushDescriptorWrites(ctx);
+      vkDestroyImageView(ctx.device, image->imageView, nullptr);
+
+      if (image->sampledDescriptor)
+      {
+        ctx.sampledImageDescriptorAllocator.Free(image->sampledDescriptor->index);
+      }
+
+      if (image->storageDescriptor)
+      {
+        ctx.storageImageDescriptorAllocator.Free(image->storageDescriptor->index);
+      }
+
+      delete image;
+    });
 }
 
 gfx_sampled_image_descriptor gfx_get_sampled_image_descriptor(gfx_image image)
@@ -430,4 +436,9 @@ gfx_sampled_image_descriptor gfx_get_sampled_image_descriptor(gfx_image image)
 gfx_storage_image_descriptor gfx_get_storage_image_descriptor(gfx_image image)
 {
   return image->storageDescriptor.value();
+}
+
+void gfx_flush_descriptor_writes()
+{
+  gfx2::internal::FlushDescriptorWrites(gfx2::internal::GetContextInstance());
 }
\ No newline at end of file
@@ -3,74 +3,210 @@
 #include "detail/context.hpp"
 #include "gfx2.h"
 
-#include <algorithm>
-#include <array>
 #include <cassert>
+#include <optional>
 
-void* gfx_malloc(size_t bytes)
-{
-  assert(bytes > 0);
-
-  auto& ctx = gfx2::internal::GetContextInstance();
-
-  VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
-                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+using namespace gfx2::internal;
 
-  const auto queueFamilyIndices = std::array{ctx.graphicsQueueFamilyIndex, ctx.computeQueueFamilyIndex, ctx.transferQueueFamilyIndex};
+namespace
+{
+  VmaAllocationCreateInfo ToVmaAllocationCreateInfo(gfx_memory_usage usage)
+  {
+    // Host-cached memory is not guaranteed to be coherent, and nothing in the API flushes or invalidates, so coherence is required wherever random host access is requested.
+    switch (usage)
+    {
+    case GFX_MEMORY_USAGE_DEFAULT:
+      return {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+      };
+    case GFX_MEMORY_USAGE_GPU_ONLY:
+      return {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+      };
+    case GFX_MEMORY_USAGE_UPLOAD:
+      return {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+      };
+    case GFX_MEMORY_USAGE_READBACK:
+      return {
+        .flags         = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT,
+        .usage         = VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+        .requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      };
+    case GFX_MEMORY_USAGE_RANDOM_ACCESS:
+      return {
+        .flags         = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT,
+        .usage         = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+        .requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      };
+    default: assert(0); return {};
+    }
+  }
+
+  std::optional<MemoryMapping> SuballocateFromBlock(const MemoryBlock& block, size_t bytes)
+  {
+    auto virtualAllocation = VmaVirtualAllocation{};
+    auto offset            = VkDeviceSize{};
+    if (vmaVirtualAllocate(block.virtualBlock,
+          ToPtr(VmaVirtualAllocationCreateInfo{
+            .size      = bytes,
+            .alignment = Context::SUBALLOCATION_ALIGNMENT,
+          }),
+          &virtualAllocation,
+          &offset) != VK_SUCCESS)
+    {
+      return std::nullopt;
+    }
+
+    return MemoryMapping{
+      .begin             = block.hostAddress ? block.hostAddress + offset : 0,
+      .end               = block.hostAddress ? block.hostAddress + offset + bytes : 0,
+      .deviceAddress     = block.deviceAddress + offset,
+      .size              = bytes,
+      .allocation        = VK_NULL_HANDLE,
+      .buffer            = block.buffer,
+      .bufferOffset      = offset,
+      .virtualBlock      = block.virtualBlock,
+      .virtualAllocation = virtualAllocation,
+    };
+  }
+
+  MemoryMapping Suballocate(Context& ctx, size_t bytes, gfx_memory_usage usage)
+  {
+    auto& blocks = ctx.memoryBlocks[usage];
+    for (const auto& block : blocks)
+    {
+      if (auto mapping = SuballocateFromBlock(block, bytes))
+      {
+        return *mapping;
+      }
+    }
+
+    auto& block = blocks.emplace_back(CreateBuffer(ctx, Context::MEMORY_BLOCK_SIZE, usage));
+    CheckVkResult(vmaCreateVirtualBlock(ToPtr(VmaVirtualBlockCreateInfo{.size = Context::MEMORY_BLOCK_SIZE}), &block.virtualBlock));
+
+    auto mapping = SuballocateFromBlock(block, bytes);
+    assert(mapping);
+    return *mapping;
+  }
+
+  // The mapping is already removed from the index, so only the memory itself waits for deferred destruction.
+  void Release(Context& ctx, const MemoryMapping& mapping)
+  {
+    DeferDestruction(ctx,
+      [&ctx, mapping]
+      {
+        if (mapping.virtualBlock)
+        {
+          vmaVirtualFree(mapping.virtualBlock, mapping.virtualAllocation);
+        }
+        else
+        {
+          vmaDestroyBuffer(ctx.allocator, mapping.buffer, mapping.allocation);
+        }
+      });
+  }
+} // namespace
+
+MemoryBlock gfx2::internal::CreateBuffer(const Context& ctx, VkDeviceSize size, gfx_memory_usage usage)
+{
+  VkBufferUsageFlags bufferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
 
-  auto mapping = gfx2::internal::MemoryMapping{};
+  auto block          = MemoryBlock{};
   auto allocationInfo = VmaAllocationInfo{};
-  vmaCreateBuffer(ctx.allocator,
+  CheckVkResult(vmaCreateBuffer(ctx.allocator,
     ToPtr(VkBufferCreateInfo{
       .sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .size                  = bytes,
-      .usage                 = usage,
-      .sharingMode           = VK_SHARING_MODE_CONCURRENT,
-      .queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size()),
-      .pQueueFamilyIndices   = queueFamilyIndices.data(),
-    }),
-    ToPtr(VmaAllocationCreateInfo{
-      .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-      .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+      .size                  = size,
+      .usage                 = bufferUsage,
+      .sharingMode           = ctx.sharingMode,
+      .queueFamilyIndexCount = ctx.numUniqueQueueFamilies,
+      .pQueueFamilyIndices   = ctx.uniqueQueueFamilyIndices,
     }),
-    &mapping.buffer,
-    &mapping.allocation,
-    &allocationInfo);
+    ToPtr(ToVmaAllocationCreateInfo(usage)),
+    &block.buffer,
+    &block.allocation,
+    &allocationInfo));
 
-  mapping.deviceAddress = vkGetBufferDeviceAddress(ctx.device,
+  block.deviceAddress = vkGetBufferDeviceAddress(ctx.device,
     ToPtr(VkBufferDeviceAddressInfo{
       .sType  = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      .buffer = mapping.buffer,
+      .buffer = block.buffer,
     }));
 
-  mapping.begin = reinterpret_cast<uintptr_t>(allocationInfo.pMappedData);
-  mapping.end   = mapping.begin + bytes;
+  block.hostAddress = reinterpret_cast<uintptr_t>(allocationInfo.pMappedData);
+
+  return block;
+}
 
-  ctx.memoryMappings.mappings.emplace_back(mapping);
+gfx_allocation gfx_malloc_ex(size_t bytes, gfx_memory_usage usage)
+{
+  assert(bytes > 0);
 
-  return allocationInfo.pMappedData;
+  auto& ctx = GetContextInstance();
+
+  auto mapping = MemoryMapping{};
+  if (bytes <= Context::MAX_SUBALLOCATION_SIZE)
+  {
+    mapping = Suballocate(ctx, bytes, usage);
+  }
+  else
+  {
+    const auto buffer = CreateBuffer(ctx, bytes, usage);
+    mapping = MemoryMapping{
+      .begin         = buffer.hostAddress,
+      .end           = buffer.hostAddress ? buffer.hostAddress + bytes : 0,
+      .deviceAddress = buffer.deviceAddress,
+      .size          = bytes,
+      .allocation    = buffer.allocation,
+      .buffer        = buffer.buffer,
+      .bufferOffset  = 0,
+    };
+  }
+
+  ctx.memoryMappings.Insert(mapping);
+
+  return {
+    .host_ptr   = reinterpret_cast<void*>(mapping.begin),
+    .device_ptr = reinterpret_cast<void*>(mapping.deviceAddress),
+  };
 }
 
-void gfx_free(void* ptr)
+void gfx_free_ex(gfx_allocation allocation)
 {
-  auto& ctx = gfx2::internal::GetContextInstance();
-  auto it = std::ranges::find_if(ctx.memoryMappings.mappings, [ptr](const auto& mapping) -> bool
-  { 
-    return mapping.begin == reinterpret_cast<uintptr_t>(ptr);
-  });
+  auto& ctx = GetContextInstance();
+  if (PostFromCompletionThread(ctx, [allocation] { gfx_free_ex(allocation); }))
+  {
+    return;
+  }
+
+  Release(ctx, ctx.memoryMappings.EraseDeviceAddress(allocation.device_ptr));
+}
 
-  assert(it != ctx.memoryMappings.mappings.end());
+void* gfx_malloc(size_t bytes)
+{
+  return gfx_malloc_ex(bytes, GFX_MEMORY_USAGE_DEFAULT).host_ptr;
+}
 
-  vmaDestroyBuffer(ctx.allocator, it->buffer, it->allocation);
+void gfx_free(void* ptr)
+{
+  auto& ctx = GetContextInstance();
+  if (PostFromCompletionThread(ctx, [ptr] { gfx_free(ptr); }))
+  {
+    return;
+  }
 
-  ctx.memoryMappings.mappings.erase(it);
+  Release(ctx, ctx.memoryMappings.Erase(ptr));
 }
 
 void* gfx_host_to_device_ptr(void* ptr)
 {
   static_assert(sizeof(void*) == sizeof(VkDeviceAddress));
 
-  auto& ctx = gfx2::internal::GetContextInstance();
+  auto& ctx = GetContextInstance();
   return reinterpret_cast<void*>(ctx.memoryMappings.HostToDeviceAddress(ptr));
 }
\ No newline at end of file
@@ -2,49 +2,387 @@
 #include "detail/common.hpp"
 #include "detail/context.hpp"
 
-gfx_compute_pipeline gfx_create_compute_pipeline(gfx_byte_span code)
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
 {
-  auto& ctx = gfx2::internal::GetContextInstance();
+  // Prepended to the driver's blob so that a file from a different device or driver version is rejected before it reaches the driver.
+  struct PipelineCacheFileHeader
+  {
+    uint32_t magic;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+  };
 
-  auto* pipeline = new gfx_compute_pipeline_t{};
-  auto shaderModule = VkShaderModule{};
-  vkCreateShaderModule(ctx.device,
-    ToPtr(VkShaderModuleCreateInfo{
-      .sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-      .codeSize = code.size,
-      .pCode    = static_cast<const uint32_t*>(code.ptr),
-    }),
-    nullptr,
-    &shaderModule);
-
-  CheckVkResult(vkCreateComputePipelines(ctx.device,
-    VK_NULL_HANDLE,
-    1,
-    ToPtr(VkComputePipelineCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-      .stage =
-        VkPipelineShaderStageCreateInfo{
-          .sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-          .stage               = VK_SHADER_STAGE_COMPUTE_BIT,
-          .module              = shaderModule,
-          .pName               = "main",
-          .pSpecializationInfo = nullptr,
-        },
-      .layout = ctx.commonPipelineLayout,
-    }),
-    nullptr,
-    &pipeline->pipeline));
+  constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x32584647; // "GFX2"
+
+  PipelineCacheFileHeader MakePipelineCacheFileHeader(VkPhysicalDevice physicalDevice, uint64_t dataSize)
+  {
+    auto properties = VkPhysicalDeviceProperties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    auto header = PipelineCacheFileHeader{
+      .magic         = PIPELINE_CACHE_MAGIC,
+      .vendorID      = properties.vendorID,
+      .deviceID      = properties.deviceID,
+      .driverVersion = properties.driverVersion,
+      .dataSize      = dataSize,
+    };
+    std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+  }
+
+  // Serializes everything that affects the compiled pipeline, so that equal keys can share one VkPipeline.
+  std::string MakePipelineKey(const gfx_compute_pipeline_create_info& createInfo)
+  {
+    const auto constantsSize = createInfo.num_specialization_constants * sizeof(gfx_specialization_constant);
+
+    auto key = std::string();
+    key.reserve(sizeof(uint32_t) + constantsSize + createInfo.code.size);
+    key.append(reinterpret_cast<const char*>(&createInfo.num_specialization_constants), sizeof(uint32_t));
+    if (constantsSize > 0)
+    {
+      key.append(reinterpret_cast<const char*>(createInfo.specialization_constants), constantsSize);
+    }
+    key.append(static_cast<const char*>(createInfo.code.ptr), createInfo.code.size);
+    return key;
+  }
+
+  // Builds every pipeline with a single vkCreateComputePipelines call.
+  std::vector<VkPipeline> BuildComputePipelines(std::span<const gfx_compute_pipeline_create_info> createInfos)
+  {
+    auto& ctx = gfx2::internal::GetContextInstance();
+
+    auto shaderModules       = std::vector<VkShaderModule>(createInfos.size());
+    auto specializationInfos = std::vector<VkSpecializationInfo>(createInfos.size());
+    auto mapEntries          = std::vector<std::vector<VkSpecializationMapEntry>>(createInfos.size());
+    auto vkCreateInfos       = std::vector<VkComputePipelineCreateInfo>();
+    vkCreateInfos.reserve(createInfos.size());
+    for (size_t i = 0; i < createInfos.size(); i++)
+    {
+      const auto& createInfo = createInfos[i];
+      assert(createInfo.num_specialization_constants == 0 || createInfo.specialization_constants);
+
+      CheckVkResult(vkCreateShaderModule(ctx.device,
+        ToPtr(VkShaderModuleCreateInfo{
+          .sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+          .codeSize = createInfo.code.size,
+          .pCode    = static_cast<const uint32_t*>(createInfo.code.ptr),
+        }),
+        nullptr,
+        &shaderModules[i]));
+
+      // The constants array doubles as the data blob; each entry points at its own value.
+      for (uint32_t j = 0; j < createInfo.num_specialization_constants; j++)
+      {
+        mapEntries[i].push_back(VkSpecializationMapEntry{
+          .constantID = createInfo.specialization_constants[j].id,
+          .offset     = static_cast<uint32_t>(j * sizeof(gfx_specialization_constant) + offsetof(gfx_specialization_constant, value)),
+          .size       = sizeof(uint32_t),
+        });
+      }
+
+      specializationInfos[i] = VkSpecializationInfo{
+        .mapEntryCount = static_cast<uint32_t>(mapEntries[i].size()),
+        .pMapEntries   = mapEntries[i].data(),
+        .dataSize      = createInfo.num_specialization_constants * sizeof(gfx_specialization_constant),
+        .pData         = createInfo.specialization_constants,
+      };
+
+      vkCreateInfos.push_back(VkComputePipelineCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .flags = VK_PIPELINE_CREATE_DISPATCH_BASE_BIT, // Allows any pipeline to be used with gfx_cmd_dispatch_base.
+        .stage =
+          VkPipelineShaderStageCreateInfo{
+            .sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage               = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module              = shaderModules[i],
+            .pName               = "main",
+            .pSpecializationInfo = mapEntries[i].empty() ? nullptr : &specializationInfos[i],
+          },
+        .layout = ctx.commonPipelineLayout,
+      });
+    }
+
+    auto vkPipelines = std::vector<VkPipeline>(createInfos.size());
+    auto result      = VkResult{};
+    {
+      auto lock = std::shared_lock(ctx.pipelineCacheMutex);
+      result    = vkCreateComputePipelines(ctx.device,
+        ctx.pipelineCache,
+        static_cast<uint32_t>(vkCreateInfos.size()),
+        vkCreateInfos.data(),
+        nullptr,
+        vkPipelines.data());
+    }
+
+    for (auto shaderModule : shaderModules)
+    {
+      vkDestroyShaderModule(ctx.device, shaderModule, nullptr);
+    }
+
+    CheckVkResult(result);
+    return vkPipelines;
+  }
+
+  // Returns live pipelines for keys that were created before and builds the rest.
+  void CreateComputePipelines(std::span<const gfx_compute_pipeline_create_info> createInfos, gfx_compute_pipeline* pipelines)
+  {
+    auto& ctx = gfx2::internal::GetContextInstance();
+
+    auto keys = std::vector<std::string>();
+    keys.reserve(createInfos.size());
+    for (const auto& createInfo : createInfos)
+    {
+      keys.push_back(MakePipelineKey(createInfo));
+    }
+
+    auto missing      = std::vector<size_t>();
+    auto missingInfos = std::vector<gfx_compute_pipeline_create_info>();
+    {
+      auto lock = std::lock_guard(ctx.computePipelinesMutex);
+      for (size_t i = 0; i < createInfos.size(); i++)
+      {
+        if (auto it = ctx.computePipelines.find(keys[i]); it != ctx.computePipelines.end())
+        {
+          it->second->refCount++;
+          pipelines[i] = it->second;
+        }
+        else
+        {
+          missing.push_back(i);
+          missingInfos.push_back(createInfos[i]);
+        }
+      }
+    }
+
+    if (missing.empty())
+    {
+      return;
+    }
+
+    // The lock is not held while compiling, so another thread (or an earlier entry in this batch) may have inserted the same key meanwhile.
+    const auto vkPipelines = BuildComputePipelines(missingInfos);
+
+    auto lock = std::lock_guard(ctx.computePipelinesMutex);
+    for (size_t j = 0; j < missing.size(); j++)
+    {
+      const auto i = missing[j];
+      auto it      = ctx.computePipelines.find(keys[i]);
+      if (it == ctx.computePipelines.end())
+      {
+        auto* pipeline = new gfx_compute_pipeline_t{.pipeline = vkPipelines[j], .refCount = 0, .key = std::move(keys[i])};
+        it             = ctx.computePipelines.emplace(pipeline->key, pipeline).first;
+      }
+      else
+      {
+        vkDestroyPipeline(ctx.device, vkPipelines[j], nullptr);
+      }
+
+      it->second->refCount++;
+      pipelines[i] = it->second;
+    }
+  }
+
+  // Drivers tend to compile a batch serially, so large batches are split across threads, each making one call.
+  void CreateComputePipelinesParallel(std::span<const gfx_compute_pipeline_create_info> createInfos, gfx_compute_pipeline* pipelines)
+  {
+    if (createInfos.empty())
+    {
+      return;
+    }
+
+    const auto numThreads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, createInfos.size());
+    if (numThreads == 1)
+    {
+      CreateComputePipelines(createInfos, pipelines);
+      return;
+    }
+
+    const auto chunkSize = (createInfos.size() + numThreads - 1) / numThreads;
+    auto tasks = std::vector<std::future<void>>();
+    for (size_t first = 0; first < createInfos.size(); first += chunkSize)
+    {
+      const auto chunk = createInfos.subspan(first, std::min(chunkSize, createInfos.size() - first));
+      tasks.push_back(std::async(std::launch::async, [chunk, pipelines, first] { CreateComputePipelines(chunk, pipelines + first); }));
+    }
+
+    for (auto& task : tasks)
+    {
+      task.get();
+    }
+  }
+} // namespace
+
+struct gfx_pipeline_build_t
+{
+  std::vector<gfx_compute_pipeline_create_info> createInfos;
+  std::vector<gfx_compute_pipeline> pipelines;
+  std::future<void> future;
+};
+
+gfx_compute_pipeline gfx_create_compute_pipeline(gfx_byte_span code)
+{
+  return gfx_create_compute_pipeline_ex(ToPtr(gfx_compute_pipeline_create_info{.code = code}));
+}
 
-  vkDestroyShaderModule(ctx.device, shaderModule, nullptr);
+gfx_compute_pipeline gfx_create_compute_pipeline_ex(const gfx_compute_pipeline_create_info* create_info)
+{
+  assert(create_info);
 
+  auto pipeline = gfx_compute_pipeline{};
+  CreateComputePipelines({create_info, 1}, &pipeline);
   return pipeline;
 }
 
+void gfx_create_compute_pipelines(const gfx_compute_pipeline_create_info* create_infos, uint32_t count, gfx_compute_pipeline* pipelines)
+{
+  assert(count == 0 || (create_infos && pipelines));
+  CreateComputePipelinesParallel({create_infos, count}, pipelines);
+}
+
+gfx_pipeline_build gfx_create_compute_pipelines_async(const gfx_compute_pipeline_create_info* create_infos, uint32_t count)
+{
+  assert(count == 0 || create_infos);
+
+  auto* build        = new gfx_pipeline_build_t{};
+  build->createInfos = {create_infos, create_infos + count};
+  build->pipelines   = std::vector<gfx_compute_pipeline>(count);
+  build->future      = std::async(std::launch::async, [build] { CreateComputePipelinesParallel(build->createInfos, build->pipelines.data()); });
+  return build;
+}
+
+int gfx_is_pipeline_build_complete(gfx_pipeline_build build)
+{
+  return build->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void gfx_finish_pipeline_build(gfx_pipeline_build build, gfx_compute_pipeline* pipelines)
+{
+  assert(build->pipelines.empty() || pipelines);
+
+  build->future.get();
+  std::ranges::copy(build->pipelines, pipelines);
+  delete build;
+}
+
 void gfx_destroy_compute_pipeline(gfx_compute_pipeline pipeline)
 {
   assert(pipeline);
   auto& ctx = gfx2::internal::GetContextInstance();
+  if (gfx2::internal::PostFromCompletionThread(ctx, [pipeline] { gfx_destroy_compute_pipeline(pipeline); }))
+  {
+    return;
+  }
+
+  {
+    auto lock = std::lock_guard(ctx.computePipelinesMutex);
+    assert(pipeline->refCount > 0);
+    if (--pipeline->refCount > 0)
+    {
+      return;
+    }
+    ctx.computePipelines.erase(pipeline->key);
+  }
+
+  gfx2::internal::DeferDestruction(ctx,
+    [&ctx, pipeline]
+    {
+      vkDestroyPipeline(ctx.device, pipeline->pipeline, nullptr);
+      delete pipeline;
+    });
+}
+
+gfx_error_t gfx_pipeline_cache_save(const char* path)
+{
+  assert(path);
+  auto& ctx = gfx2::internal::GetContextInstance();
+
+  auto dataSize = size_t{};
+  auto data     = std::vector<char>();
+  {
+    // Exclusive, so pipelines created on other threads cannot grow the cache between the size query and the copy.
+    auto lock = std::unique_lock(ctx.pipelineCacheMutex);
+    CheckVkResult(vkGetPipelineCacheData(ctx.device, ctx.pipelineCache, &dataSize, nullptr));
+    data.resize(dataSize);
+    CheckVkResult(vkGetPipelineCacheData(ctx.device, ctx.pipelineCache, &dataSize, data.data()));
+  }
+
+  const auto header = MakePipelineCacheFileHeader(ctx.physicalDevice, dataSize);
+
+  auto file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(data.data(), static_cast<std::streamsize>(dataSize));
+
+  return file ? 0 : 1;
+}
+
+gfx_error_t gfx_pipeline_cache_load(const char* path)
+{
+  assert(path);
+  auto& ctx = gfx2::internal::GetContextInstance();
+
+  auto file = std::ifstream(path, std::ios::binary);
+  auto header = PipelineCacheFileHeader{};
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+  {
+    return 1;
+  }
+
+  const auto expected = MakePipelineCacheFileHeader(ctx.physicalDevice, header.dataSize);
+  if (std::memcmp(&header, &expected, sizeof(header)) != 0)
+  {
+    return 1;
+  }
+
+  // Check the size against the file before trusting it with an allocation, so a truncated or corrupt file cannot ask for gigabytes.
+  const auto dataBegin = file.tellg();
+  file.seekg(0, std::ios::end);
+  const auto dataEnd = file.tellg();
+  if (dataEnd - dataBegin != static_cast<std::streamoff>(header.dataSize))
+  {
+    return 1;
+  }
+  file.seekg(dataBegin);
+
+  auto data = std::vector<char>(header.dataSize);
+  if (!file.read(data.data(), static_cast<std::streamsize>(header.dataSize)))
+  {
+    return 1;
+  }
+
+  // Merging instead of replacing keeps pipelines that were already compiled this run.
+  auto loadedCache = VkPipelineCache{};
+  CheckVkResult(vkCreatePipelineCache(ctx.device,
+    ToPtr(VkPipelineCacheCreateInfo{
+      .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = data.size(),
+      .pInitialData    = data.data(),
+    }),
+    nullptr,
+    &loadedCache));
+
+  auto result = VkResult{};
+  {
+    // The destination of a merge must be externally synchronized, including against pipelines being created with it on other threads.
+    auto lock = std::unique_lock(ctx.pipelineCacheMutex);
+    result    = vkMergePipelineCaches(ctx.device, ctx.pipelineCache, 1, &loadedCache);
+  }
+  vkDestroyPipelineCache(ctx.device, loadedCache, nullptr);
+  CheckVkResult(result);
 
-  vkDestroyPipeline(ctx.device, pipeline->pipeline, nullptr);
-  delete pipeline;
+  return 0;
 }
\ No newline at end of file
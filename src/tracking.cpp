@@ -0,0 +1,97 @@
+#include "detail/tracking.hpp"
+
+namespace
+{
+  constexpr VkAccessFlags2 WRITE_ACCESS = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT |
+                                          VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+                                          VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+  bool Equals(const gfx2::internal::HazardTracker::Resource& a, const gfx2::internal::HazardTracker::Resource& b)
+  {
+    return a.image == b.image && a.begin == b.begin && a.end == b.end;
+  }
+} // namespace
+
+bool gfx2::internal::HazardTracker::Overlaps(const Resource& a, const Resource& b)
+{
+  if (a.image || b.image)
+  {
+    return a.image == b.image;
+  }
+  return a.begin < b.end && b.begin < a.end;
+}
+
+void gfx2::internal::HazardTracker::Access(const Resource& resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkMemoryBarrier2& barrier)
+{
+  const auto isWrite    = (access & WRITE_ACCESS) != 0;
+  const auto readAccess = access & ~WRITE_ACCESS;
+
+  auto found = false;
+  for (auto& state : states_)
+  {
+    if (!Overlaps(state.resource, resource))
+    {
+      continue;
+    }
+    found = found || Equals(state.resource, resource);
+
+    const auto NeedsVisibility = [&](VkAccessFlags2 accessMask)
+    {
+      return state.writeStages != 0 && ((stage & ~state.visibleStages) != 0 || (accessMask & ~state.visibleAccess) != 0);
+    };
+
+    if (isWrite && state.readStages != 0)
+    {
+      // Write-after-read only needs the reads to have executed. Every read already waited for the last write, so this chains after it as well.
+      barrier.srcStageMask |= state.readStages;
+      barrier.dstStageMask |= stage;
+    }
+    else if (isWrite && NeedsVisibility(access))
+    {
+      // Write-after-write needs the last write to be made visible to this access.
+      barrier.srcStageMask |= state.writeStages;
+      barrier.srcAccessMask |= state.writeAccess;
+      barrier.dstStageMask |= stage;
+      barrier.dstAccessMask |= access;
+      state.visibleStages |= stage;
+      state.visibleAccess |= access;
+    }
+
+    // Read-after-write, checked separately so that the read half of a read-write access still sees the last write when the write half only
+    // had to wait for earlier reads.
+    if (readAccess != 0 && NeedsVisibility(readAccess))
+    {
+      barrier.srcStageMask |= state.writeStages;
+      barrier.srcAccessMask |= state.writeAccess;
+      barrier.dstStageMask |= stage;
+      barrier.dstAccessMask |= readAccess;
+      state.visibleStages |= stage;
+      state.visibleAccess |= readAccess;
+    }
+
+    if (isWrite)
+    {
+      state.writeStages   = stage;
+      state.writeAccess   = access & WRITE_ACCESS;
+      state.visibleStages = 0;
+      state.visibleAccess = 0;
+      state.readStages    = 0;
+    }
+    else
+    {
+      state.readStages |= stage;
+    }
+  }
+
+  if (!found)
+  {
+    states_.push_back(ResourceState{
+      .resource      = resource,
+      .writeStages   = isWrite ? stage : 0,
+      .writeAccess   = access & WRITE_ACCESS,
+      .visibleStages = 0,
+      .visibleAccess = 0,
+      .readStages    = isWrite ? 0 : stage,
+    });
+  }
+}
\ No newline at end of file
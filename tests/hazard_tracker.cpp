@@ -0,0 +1,189 @@
+// Checks the barriers HazardTracker asks for. The tracker only depends on Vulkan's flag types, so this runs without a device.
+#include "detail/tracking.hpp"
+#include "check.hpp"
+
+#include <print>
+
+namespace
+{
+  using gfx2::internal::HazardTracker;
+  using Resource = HazardTracker::Resource;
+
+  constexpr auto COMPUTE        = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  constexpr auto TRANSFER       = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  constexpr auto STORAGE_READ   = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+  constexpr auto STORAGE_WRITE  = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+  constexpr auto TRANSFER_READ  = VK_ACCESS_2_TRANSFER_READ_BIT;
+  constexpr auto TRANSFER_WRITE = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+  constexpr auto BUFFER   = Resource{.image = nullptr, .begin = 0x1000, .end = 0x2000};
+  constexpr auto SUBRANGE = Resource{.image = nullptr, .begin = 0x1800, .end = 0x1900};
+  constexpr auto DISJOINT = Resource{.image = nullptr, .begin = 0x3000, .end = 0x4000};
+
+  // Access for a command that touches a single resource.
+  VkMemoryBarrier2 Access(HazardTracker& tracker, const Resource& resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access)
+  {
+    auto barrier = VkMemoryBarrier2{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    tracker.Access(resource, stage, access, barrier);
+    return barrier;
+  }
+
+  bool IsEmpty(const VkMemoryBarrier2& barrier)
+  {
+    return barrier.srcStageMask == 0 && barrier.srcAccessMask == 0 && barrier.dstStageMask == 0 && barrier.dstAccessMask == 0;
+  }
+
+  void ReadAfterWrite()
+  {
+    auto tracker = HazardTracker();
+    CHECK(IsEmpty(Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE)));
+
+    const auto barrier = Access(tracker, BUFFER, COMPUTE, STORAGE_READ);
+    CHECK(barrier.srcStageMask == TRANSFER);
+    CHECK(barrier.srcAccessMask == TRANSFER_WRITE);
+    CHECK(barrier.dstStageMask == COMPUTE);
+    CHECK(barrier.dstAccessMask == STORAGE_READ);
+  }
+
+  // A read only needs the write made visible once. Later reads from the same stage are already covered.
+  void RepeatedReadsAfterVisibleWrite()
+  {
+    auto tracker = HazardTracker();
+    Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE);
+    CHECK(!IsEmpty(Access(tracker, BUFFER, COMPUTE, STORAGE_READ)));
+    CHECK(IsEmpty(Access(tracker, BUFFER, COMPUTE, STORAGE_READ)));
+    CHECK(IsEmpty(Access(tracker, BUFFER, COMPUTE, STORAGE_READ)));
+  }
+
+  void ReadAfterRead()
+  {
+    auto tracker = HazardTracker();
+    CHECK(IsEmpty(Access(tracker, BUFFER, COMPUTE, STORAGE_READ)));
+    CHECK(IsEmpty(Access(tracker, BUFFER, TRANSFER, TRANSFER_READ)));
+    CHECK(IsEmpty(Access(tracker, BUFFER, COMPUTE, STORAGE_READ)));
+  }
+
+  // Reads leave nothing to make visible, so the write only has to wait for them to execute.
+  void WriteAfterRead()
+  {
+    auto tracker = HazardTracker();
+    Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE);
+    Access(tracker, BUFFER, COMPUTE, STORAGE_READ);
+
+    const auto barrier = Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE);
+    CHECK(barrier.srcStageMask == COMPUTE);
+    CHECK(barrier.srcAccessMask == 0);
+    CHECK(barrier.dstStageMask == TRANSFER);
+    CHECK(barrier.dstAccessMask == 0);
+  }
+
+  // An in-place update after a write and an unrelated read: the write half waits for the read, and the read half still needs the write.
+  void ReadWriteAfterWriteAndRead()
+  {
+    constexpr auto SAMPLED_READ = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+
+    auto tracker = HazardTracker();
+    Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE);
+    Access(tracker, BUFFER, COMPUTE, SAMPLED_READ);
+
+    const auto barrier = Access(tracker, BUFFER, COMPUTE, STORAGE_READ | STORAGE_WRITE);
+    CHECK((barrier.srcStageMask & COMPUTE) != 0);
+    CHECK((barrier.srcStageMask & TRANSFER) != 0);
+    CHECK(barrier.srcAccessMask == TRANSFER_WRITE);
+    CHECK(barrier.dstStageMask == COMPUTE);
+    CHECK((barrier.dstAccessMask & STORAGE_READ) != 0);
+
+    // The same from a stage that has not seen the write at all.
+    auto other = HazardTracker();
+    Access(other, BUFFER, COMPUTE, STORAGE_WRITE);
+    Access(other, BUFFER, COMPUTE, STORAGE_READ);
+
+    const auto otherBarrier = Access(other, BUFFER, TRANSFER, TRANSFER_READ | TRANSFER_WRITE);
+    CHECK(otherBarrier.srcAccessMask == STORAGE_WRITE);
+    CHECK(otherBarrier.dstStageMask == TRANSFER);
+    CHECK((otherBarrier.dstAccessMask & TRANSFER_READ) != 0);
+  }
+
+  void WriteAfterWrite()
+  {
+    auto tracker = HazardTracker();
+    Access(tracker, BUFFER, COMPUTE, STORAGE_WRITE);
+
+    const auto barrier = Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE);
+    CHECK(barrier.srcStageMask == COMPUTE);
+    CHECK(barrier.srcAccessMask == STORAGE_WRITE);
+    CHECK(barrier.dstStageMask == TRANSFER);
+    CHECK(barrier.dstAccessMask == TRANSFER_WRITE);
+  }
+
+  void DisjointRanges()
+  {
+    auto tracker = HazardTracker();
+    Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE);
+    CHECK(IsEmpty(Access(tracker, DISJOINT, COMPUTE, STORAGE_WRITE)));
+
+    // Only waits for the write to its own range.
+    const auto barrier = Access(tracker, DISJOINT, COMPUTE, STORAGE_READ);
+    CHECK(barrier.srcStageMask == COMPUTE);
+    CHECK(barrier.srcAccessMask == STORAGE_WRITE);
+  }
+
+  void PartialOverlap()
+  {
+    auto tracker = HazardTracker();
+    Access(tracker, BUFFER, TRANSFER, TRANSFER_WRITE);
+
+    // Reading part of the written range waits for the whole write.
+    auto barrier = Access(tracker, SUBRANGE, COMPUTE, STORAGE_READ);
+    CHECK(barrier.srcStageMask == TRANSFER);
+    CHECK(barrier.srcAccessMask == TRANSFER_WRITE);
+    CHECK(barrier.dstStageMask == COMPUTE);
+    CHECK(barrier.dstAccessMask == STORAGE_READ);
+
+    // That barrier was global, so the write is now visible to compute reads of the whole range.
+    CHECK(IsEmpty(Access(tracker, BUFFER, COMPUTE, STORAGE_READ)));
+
+    // Writing the subrange has to wait for the reads of the enclosing range.
+    barrier = Access(tracker, SUBRANGE, COMPUTE, STORAGE_WRITE);
+    CHECK(barrier.srcStageMask == COMPUTE);
+    CHECK(barrier.srcAccessMask == 0);
+
+    // Reading the enclosing range then sees the subrange write.
+    barrier = Access(tracker, BUFFER, TRANSFER, TRANSFER_READ);
+    CHECK(barrier.srcStageMask == COMPUTE);
+    CHECK(barrier.srcAccessMask == STORAGE_WRITE);
+    CHECK(barrier.dstStageMask == TRANSFER);
+    CHECK(barrier.dstAccessMask == TRANSFER_READ);
+  }
+
+  // Images are tracked by identity, never by address range.
+  void Images()
+  {
+    auto tracker    = HazardTracker();
+    const int image = 0;
+    const auto use  = Resource{.image = &image, .begin = 0, .end = 0};
+
+    Access(tracker, use, COMPUTE, STORAGE_WRITE);
+    CHECK(IsEmpty(Access(tracker, BUFFER, COMPUTE, STORAGE_READ)));
+
+    const auto barrier = Access(tracker, use, COMPUTE, STORAGE_READ);
+    CHECK(barrier.srcStageMask == COMPUTE);
+    CHECK(barrier.srcAccessMask == STORAGE_WRITE);
+  }
+} // namespace
+
+int main()
+{
+  ReadAfterWrite();
+  RepeatedReadsAfterVisibleWrite();
+  ReadAfterRead();
+  WriteAfterRead();
+  WriteAfterWrite();
+  ReadWriteAfterWriteAndRead();
+  DisjointRanges();
+  PartialOverlap();
+  Images();
+
+  std::println("All hazard tracker checks passed.");
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,272 @@
+// Records command buffers on many threads at once while a single thread submits and destroys them. Each recording uploads a pattern to an
+// image and reads it back, so corrupted recordings show up as wrong data. Meant to run on a software driver such as lavapipe, and with
+// validation layers when they are installed.
+#include "gfx2.h"
+#include "gfx2_vulkan.h"
+#include "detail/common.hpp"
+#include "check.hpp"
+
+#include "vulkan/vulkan_core.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <print>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  constexpr uint32_t NUM_THREADS    = 8;
+  constexpr uint32_t NUM_ITERATIONS = 200;
+  constexpr uint32_t IMAGE_SIZE     = 16;
+  constexpr uint32_t NUM_TEXELS     = IMAGE_SIZE * IMAGE_SIZE;
+
+  // Returned when there is no Vulkan 1.3 device, so ctest reports the test as skipped rather than failed.
+  constexpr int SKIP_RETURN_CODE = 77;
+
+  struct VulkanObjects
+  {
+    VkInstance instance;
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t graphicsQueueIndex;
+    uint32_t computeQueueIndex;
+    uint32_t transferQueueIndex;
+  };
+
+  // Like the example's setup, except that devices with a single queue family (as software drivers usually have) use it for every queue.
+  bool InitializeVulkan(VulkanObjects& objects)
+  {
+    auto appInfo = VkApplicationInfo{
+      .sType      = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .apiVersion = VK_API_VERSION_1_3,
+    };
+    auto instanceInfo = VkInstanceCreateInfo{
+      .sType            = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+      .pApplicationInfo = &appInfo,
+    };
+
+    if (vkCreateInstance(&instanceInfo, nullptr, &objects.instance) != VK_SUCCESS)
+    {
+      return false;
+    }
+
+    auto u32one = uint32_t{1};
+    if (vkEnumeratePhysicalDevices(objects.instance, &u32one, &objects.physicalDevice) < 0 || !objects.physicalDevice)
+    {
+      return false;
+    }
+
+    auto properties = VkPhysicalDeviceProperties{};
+    vkGetPhysicalDeviceProperties(objects.physicalDevice, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_3)
+    {
+      return false;
+    }
+
+    if (gfx_vulkan_get_queue_family_indices(objects.physicalDevice, &objects.graphicsQueueIndex, &objects.computeQueueIndex, &objects.transferQueueIndex))
+    {
+      objects.graphicsQueueIndex = 0;
+      objects.computeQueueIndex  = 0;
+      objects.transferQueueIndex = 0;
+    }
+
+    auto f32one = float{1};
+
+    auto queueCreateInfos = std::vector<VkDeviceQueueCreateInfo>();
+    for (auto index : {objects.graphicsQueueIndex, objects.computeQueueIndex, objects.transferQueueIndex})
+    {
+      if (std::ranges::none_of(queueCreateInfos, [index](const auto& info) { return info.queueFamilyIndex == index; }))
+      {
+        queueCreateInfos.push_back(VkDeviceQueueCreateInfo{
+          .sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+          .queueFamilyIndex = index,
+          .queueCount       = 1,
+          .pQueuePriorities = &f32one,
+        });
+      }
+    }
+
+    auto features13 = VkPhysicalDeviceVulkan13Features{};
+    auto features12 = VkPhysicalDeviceVulkan12Features{};
+    auto features11 = VkPhysicalDeviceVulkan11Features{};
+    auto features10 = VkPhysicalDeviceFeatures2{};
+    gfx_vulkan_get_required_features(&features10, &features11, &features12, &features13);
+
+    auto deviceCreateInfo = VkDeviceCreateInfo{
+      .sType                = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pNext                = &features10,
+      .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
+      .pQueueCreateInfos    = queueCreateInfos.data(),
+    };
+
+    return vkCreateDevice(objects.physicalDevice, &deviceCreateInfo, nullptr, &objects.device) == VK_SUCCESS;
+  }
+
+  struct Submission
+  {
+    gfx_command_buffer commandBuffer;
+    std::promise<gfx_submit_token> token;
+  };
+
+  // Recording threads hand their ended command buffers to the submitting thread through this.
+  struct SubmitQueue
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Submission*> submissions;
+
+    void Push(Submission* submission)
+    {
+      {
+        auto lock = std::lock_guard(mutex);
+        submissions.push_back(submission);
+      }
+      condition.notify_one();
+    }
+
+    Submission* Pop()
+    {
+      auto lock = std::unique_lock(mutex);
+      condition.wait(lock, [this] { return !submissions.empty(); });
+      auto* submission = submissions.front();
+      submissions.pop_front();
+      return submission;
+    }
+  };
+
+  // Resources are created, and their device addresses looked up, up front. Only recording and the address lookups it does are thread-safe.
+  struct ThreadResources
+  {
+    gfx_image image;
+    uint32_t* upload;
+    const void* uploadDevicePtr;
+    uint32_t* readback;
+    gfx_allocation readbackAllocation;
+  };
+
+  uint32_t Pattern(uint32_t thread, uint32_t iteration, uint32_t texel)
+  {
+    return (thread << 24) ^ (iteration << 12) ^ texel;
+  }
+
+  void RecordingThreadMain(uint32_t thread, const ThreadResources& resources, SubmitQueue& submitQueue)
+  {
+    for (uint32_t iteration = 0; iteration < NUM_ITERATIONS; iteration++)
+    {
+      for (uint32_t texel = 0; texel < NUM_TEXELS; texel++)
+      {
+        resources.upload[texel]   = Pattern(thread, iteration, texel);
+        resources.readback[texel] = 0;
+      }
+
+      auto copy = gfx_copy_buffer_image_info{
+        .buffer      = resources.uploadDevicePtr,
+        .image       = resources.image,
+        .layer_count = 1,
+        .extent      = {IMAGE_SIZE, IMAGE_SIZE, 1},
+      };
+
+      auto cmd = gfx_create_command_buffer(GFX_QUEUE_COMPUTE);
+      gfx_cmd_init_discard_image(cmd, resources.image);
+      gfx_cmd_barrier(cmd, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_WRITE, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_WRITE);
+      gfx_cmd_copy_buffer_to_image(cmd, &copy);
+      gfx_cmd_barrier(cmd, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_WRITE, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_READ);
+      copy.buffer = resources.readbackAllocation.device_ptr;
+      gfx_cmd_copy_image_to_buffer(cmd, &copy);
+      gfx_cmd_barrier(cmd, GFX_STAGE_TRANSFER, GFX_ACCESS_TRANSFER_WRITE, GFX_STAGE_HOST, GFX_ACCESS_HOST_READ);
+
+      // The submitting thread must not end the command buffer, as that would use this thread's command pool.
+      gfx_end_command_buffer(cmd);
+
+      auto submission = Submission{.commandBuffer = cmd, .token = {}};
+      auto token      = submission.token.get_future();
+      submitQueue.Push(&submission);
+      gfx_wait_submit(token.get());
+
+      for (uint32_t texel = 0; texel < NUM_TEXELS; texel++)
+      {
+        CHECK(resources.readback[texel] == Pattern(thread, iteration, texel));
+      }
+    }
+  }
+} // namespace
+
+int main()
+{
+  auto objects = VulkanObjects{};
+  if (!InitializeVulkan(objects))
+  {
+    std::println("No Vulkan 1.3 device available, skipping.");
+    return SKIP_RETURN_CODE;
+  }
+
+  auto initInfo = gfx_vulkan_init_info{
+    .instance                 = objects.instance,
+    .physicalDevice           = objects.physicalDevice,
+    .device                   = objects.device,
+    .graphicsQueueFamilyIndex = objects.graphicsQueueIndex,
+    .computeQueueFamilyIndex  = objects.computeQueueIndex,
+    .transferQueueFamilyIndex = objects.transferQueueIndex,
+    .deferDestruction         = 1,
+  };
+  CHECK(gfx_vulkan_initialize(&initInfo) == 0);
+
+  {
+    auto resources = std::vector<ThreadResources>(NUM_THREADS);
+    for (auto& threadResources : resources)
+    {
+      threadResources.image = gfx_create_image(ToPtr(gfx_image_create_info{
+        .type         = GFX_IMAGE_TYPE_2D,
+        .format       = GFX_FORMAT_R8G8B8A8_UNORM,
+        .extent       = {IMAGE_SIZE, IMAGE_SIZE, 1},
+        .mip_levels   = 1,
+        .array_layers = 1,
+      }));
+      threadResources.upload             = static_cast<uint32_t*>(gfx_malloc(sizeof(uint32_t) * NUM_TEXELS));
+      threadResources.uploadDevicePtr    = gfx_host_to_device_ptr(threadResources.upload);
+      threadResources.readbackAllocation = gfx_malloc_ex(sizeof(uint32_t) * NUM_TEXELS, GFX_MEMORY_USAGE_READBACK);
+      threadResources.readback           = static_cast<uint32_t*>(threadResources.readbackAllocation.host_ptr);
+    }
+
+    auto submitQueue = SubmitQueue();
+    auto threads     = std::vector<std::jthread>();
+    for (uint32_t thread = 0; thread < NUM_THREADS; thread++)
+    {
+      threads.emplace_back(RecordingThreadMain, thread, std::cref(resources[thread]), std::ref(submitQueue));
+    }
+
+    // Submits in whatever order the recordings finish, and destroys each command buffer right away so that recycling races with recording.
+    auto lastToken = gfx_submit_token{};
+    for (uint32_t i = 0; i < NUM_THREADS * NUM_ITERATIONS; i++)
+    {
+      auto* submission = submitQueue.Pop();
+      lastToken        = gfx_submit(submission->commandBuffer, nullptr, 0);
+      gfx_destroy_command_buffer(submission->commandBuffer);
+      submission->token.set_value(lastToken);
+    }
+
+    threads.clear();
+    gfx_wait_submit(lastToken);
+
+    for (const auto& threadResources : resources)
+    {
+      gfx_destroy_image(threadResources.image);
+      gfx_free(threadResources.upload);
+      gfx_free_ex(threadResources.readbackAllocation);
+    }
+  }
+
+  gfx_vulkan_shutdown();
+
+  vkDestroyDevice(objects.device, nullptr);
+  vkDestroyInstance(objects.instance, nullptr);
+
+  std::println("Recorded {} command buffers on {} threads.", NUM_THREADS * NUM_ITERATIONS, NUM_THREADS);
+  return 0;
+}
\ No newline at end of file